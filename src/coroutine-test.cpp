@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "utils.hpp"
+#include "parallel.hpp"
+#include "solution-picker.hpp"
+#include "solutions/coroutine-lookup.hpp"
+
+const int TEST_REPEAT = 5;
+/// Haystacks up to this size have at most CoroutineMinSuspendCount values left after the bin,
+/// their lookups finish without suspending
+const int64_t SMALL_HAYSTACK_COUNT = 1 << 20;
+
+/// Application code written one key at a time, worker @first of @stride searches every
+/// stride-th needle
+LookupJob lookupWorker(CoroutineIndex &index, const AlignedIntArray &needles, AlignedIndexArray &indices, int64_t first, int64_t stride) {
+	for (int64_t c = first; c < needles.getCount(); c += stride) {
+		indices[c] = co_await index.find(needles[c]);
+	}
+}
+
+/// Search all needles with @inFlight lookups running at the same time
+void coroutineSearch(CoroutineIndex &index, LookupScheduler &scheduler, const AlignedIntArray &needles, AlignedIndexArray &indices, int inFlight) {
+	std::vector<LookupJob> workers;
+	workers.reserve(inFlight);
+	for (int w = 0; w < inFlight; w++) {
+		workers.push_back(lookupWorker(index, needles, indices, w, inFlight));
+		workers.back().start(scheduler);
+	}
+	scheduler.run();
+}
+
+/// Compare coroutine lookups with the batch solutions on a .bsearch file
+/// usage: coroutine-test <file.bsearch>
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		printf("usage: %s <file.bsearch>\n", argv[0]);
+		return -1;
+	}
+
+	AlignedIntArray hayStack;
+	AlignedIntArray needles;
+	if (!loadFromFile(hayStack, needles, argv[1])) {
+		printf("Failed to load %s\n", argv[1]);
+		return -1;
+	}
+	printf("%s: %lld values, %lld needles\n", argv[1], (long long)hayStack.getCount(), (long long)needles.getCount());
+
+	AlignedIndexArray indices(needles.getCount());
+	ArenaAllocator &allocator = threadArena();
+	allocator.reserve(ARENA_RESERVE_BYTES);
+	LookupScheduler scheduler;
+	CoroutineIndex index(hayStack, scheduler);
+
+	bool failedTests = false;
+	auto measure = [&](const char *name, auto &&search) {
+		const VerifiedRun run = timeVerifiedSearch(TEST_REPEAT, hayStack, needles, indices, search);
+		failedTests |= !run.ok;
+		printf("%-24s %f ns per needle%s\n", name, double(run.bestNsec) / needles.getCount(), run.ok ? "" : " FAILED");
+	};
+
+	measure("binarySearch", [&] { binarySearch(hayStack, needles, indices); });
+	measure("eytzingerSearch<15>", [&] { eytzingerSearch<15>(hayStack, needles, indices, allocator); });
+	for (int inFlight : {1, 4, 8, 16, 32, 64}) {
+		char name[64];
+		snprintf(name, sizeof(name), "coroutines in flight %d", inFlight);
+		measure(name, [&] { coroutineSearch(index, scheduler, needles, indices, inFlight); });
+	}
+
+	// every k-th value of a bigger haystack, so the lookups that never suspend are covered too
+	if (hayStack.getCount() > SMALL_HAYSTACK_COUNT) {
+		const int64_t stride = (hayStack.getCount() + SMALL_HAYSTACK_COUNT - 1) / SMALL_HAYSTACK_COUNT;
+		AlignedIntArray smallHayStack((hayStack.getCount() + stride - 1) / stride);
+		for (int64_t c = 0; c < smallHayStack.getCount(); c++) {
+			smallHayStack[c] = hayStack[c * stride];
+		}
+		CoroutineIndex smallIndex(smallHayStack, scheduler);
+		for (int inFlight : {1, 16}) {
+			const VerifiedRun run = timeVerifiedSearch(TEST_REPEAT, smallHayStack, needles, indices, [&] {
+				coroutineSearch(smallIndex, scheduler, needles, indices, inFlight);
+			});
+			failedTests |= !run.ok;
+			printf("%lld values, in flight %-4d %f ns per needle%s\n", (long long)smallHayStack.getCount(), inFlight, double(run.bestNsec) / needles.getCount(), run.ok ? "" : " FAILED");
+		}
+	}
+	return failedTests ? -1 : 0;
+}
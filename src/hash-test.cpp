@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "utils.hpp"
+#include "parallel.hpp"
+#include "solution-picker.hpp"
+#include "solutions/hash-index.hpp"
+
+const int TEST_REPEAT = 20;
+
+/// Ordered kernels the hash index is compared with
+const SolutionInfo orderedSolutions[] = {
+	{"binarySearch", binarySearch},
+	{"eytzingerSearch<15>", eytzingerSearch<15>},
+	{"avx256", avx256},
+	{"avx256Eytzinger<15>", avx256Eytzinger<15>},
+};
+
+/// Compare HashIndex with the ordered kernels on 0.bsearch ... in the current directory
+/// The index is built once per file, its build time and memory are reported apart from the
+/// lookups, the ordered kernels build their bins inside every call
+/// usage: hash-test
+int main() {
+	ArenaAllocator &allocator = threadArena();
+	allocator.reserve(ARENA_RESERVE_BYTES);
+	bool failedTests = false;
+
+	for (int r = 0; ; r++) {
+		AlignedIntArray hayStack;
+		AlignedIntArray needles;
+		char fname[64] = { 0, };
+		snprintf(fname, sizeof(fname), "%d.bsearch", r);
+		if (!loadFromFile(hayStack, needles, fname)) {
+			break;
+		}
+
+		AlignedIndexArray indices(needles.getCount());
+		auto measure = [&](const char *name, auto &&search) {
+			const VerifiedRun run = timeVerifiedSearch(TEST_REPEAT, hayStack, needles, indices, search);
+			failedTests |= !run.ok;
+			printf("  %-24s %f ms%s\n", name, double(run.bestNsec) * 1e-6, run.ok ? "" : " FAILED");
+		};
+
+		HashIndex index;
+		const uint64_t buildStart = timer_nsec();
+		if (!index.init(hayStack)) {
+			printf("Test %d: %lld values do not fit 32 bit positions, skipped\n", r + 1, (long long)hayStack.getCount());
+			continue;
+		}
+		const double buildMs = double(timer_nsec() - buildStart) * 1e-6;
+		const double haystackBytes = double(hayStack.getCount()) * sizeof(int);
+		printf("Test %d: %lld values, %lld distinct, %lld needles, index built in %f ms, %f MB, %.2f bytes per key, %.2fx the haystack\n",
+			r + 1,
+			(long long)hayStack.getCount(),
+			(long long)index.keyCount,
+			(long long)needles.getCount(),
+			buildMs,
+			double(index.memoryBytes()) / double(1 << 20),
+			double(index.memoryBytes()) / double(std::max<int64_t>(1, index.keyCount)),
+			double(index.memoryBytes()) / haystackBytes);
+
+		for (const SolutionInfo &solution : orderedSolutions) {
+			measure(solution.name, [&] { solution.search(hayStack, needles, indices, allocator); });
+		}
+		measure("HashIndex", [&] {
+			const ArenaAllocator::Scope scope(allocator);
+			index.findBatch(needles, indices, allocator.alloc<int64_t>(needles.getCount()));
+		});
+	}
+	return failedTests ? -1 : 0;
+}
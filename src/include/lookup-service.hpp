@@ -0,0 +1,296 @@
+#pragma once
+
+#include "utils.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/// Layout of the shared memory segment used by lookup-server and its clients
+///
+/// [LookupHeader][haystack][LookupSlot 0][LookupSlot 1]...
+///
+/// Each slot belongs to one client process and has two single producer single consumer rings:
+/// the client pushes requests and the server pushes completions. Each ring entry names one of
+/// the slot's buffers, the client writes needles in it and the server writes the results next
+/// to them, so batches are never copied between the processes.
+
+const char LOOKUP_SEGMENT_NAME[] = "/bsearch-lookup";
+const uint64_t LOOKUP_MAGIC = 0x50554b4f4f4c4231ull;
+
+/// Number of entries in each ring, also the number of buffers of a slot
+const int LOOKUP_RING_ENTRIES = 64;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "rings need address free atomics");
+static_assert(std::atomic<int>::is_always_lock_free, "slots need address free atomics");
+
+struct LookupEntry {
+    /// Index of the slot buffer with the batch
+    uint32_t buffer;
+    /// Number of needles in the batch
+    uint32_t count;
+};
+
+/// Single producer single consumer ring, indices only grow and wrap with the mask
+struct LookupRing {
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+    alignas(64) LookupEntry entries[LOOKUP_RING_ENTRIES];
+
+    void init()
+    {
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    /// Called only by the producer
+    /// @return false if the ring is full
+    bool push(const LookupEntry &entry)
+    {
+        const uint64_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == LOOKUP_RING_ENTRIES) {
+            return false;
+        }
+        entries[t % LOOKUP_RING_ENTRIES] = entry;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Called only by the consumer
+    /// @return false if the ring is empty
+    bool pop(LookupEntry &entry)
+    {
+        const uint64_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        entry = entries[h % LOOKUP_RING_ENTRIES];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+struct LookupSlot {
+    /// Process id of the client holding the slot, 0 while the slot is free
+    /// The slot is claimed and freed only by changing it, so a client that dies at any point
+    /// leaves either a free slot or one with its pid, which the server can reclaim
+    alignas(64) std::atomic<int> owner;
+    LookupRing requests;
+    LookupRing completions;
+    // followed by LOOKUP_RING_ENTRIES needle buffers and LOOKUP_RING_ENTRIES result buffers
+};
+
+struct LookupHeader {
+    uint64_t magic;
+    int64_t haystackCount;
+    int64_t slotCount;
+    /// Max needles in one batch
+    int64_t batchCapacity;
+    int64_t haystackOffset;
+    int64_t slotsOffset;
+    int64_t slotBytes;
+    int64_t totalBytes;
+    std::atomic<int> ready;
+    std::atomic<int> shutdown;
+};
+
+namespace {
+inline int64_t alignTo64(int64_t bytes)
+{
+    return (bytes + 63) & -64;
+}
+
+/// @return true if process @pid is gone or is a zombie that was not reaped yet
+inline bool processExited(int pid)
+{
+    if (kill(pid, 0) == -1) {
+        return errno == ESRCH;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *stat = fopen(path, "r");
+    if (!stat) {
+        return false;
+    }
+    char state = 0;
+    // the command name in parentheses can hold spaces, the state follows its last ')'
+    char line[512];
+    if (fgets(line, sizeof(line), stat)) {
+        const char *end = strrchr(line, ')');
+        state = end && end[1] == ' ' ? end[2] : 0;
+    }
+    fclose(stat);
+    return state == 'Z';
+}
+} // namespace
+
+/// A mapping of the lookup segment, created by the server and opened by the clients
+struct LookupSegment {
+    LookupSegment() = default;
+    LookupSegment(const LookupSegment &) = delete;
+    LookupSegment &operator=(const LookupSegment &) = delete;
+
+    ~LookupSegment()
+    {
+        if (base) {
+            munmap(base, mappedBytes);
+        }
+    }
+
+    /// Create the segment, replacing an old one with the same name
+    bool create(int64_t haystackCount, int64_t slotCount, int64_t batchCapacity)
+    {
+        const int64_t haystackOffset = alignTo64(sizeof(LookupHeader));
+        const int64_t slotsOffset = haystackOffset + alignTo64(haystackCount * sizeof(int));
+        const int64_t slotBytes = alignTo64(sizeof(LookupSlot)) +
+                                  LOOKUP_RING_ENTRIES * alignTo64(batchCapacity * sizeof(int)) +
+                                  LOOKUP_RING_ENTRIES * alignTo64(batchCapacity * sizeof(int64_t));
+        const int64_t totalBytes = slotsOffset + slotCount * slotBytes;
+
+        shm_unlink(LOOKUP_SEGMENT_NAME);
+        const int fd = shm_open(LOOKUP_SEGMENT_NAME, O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) {
+            return false;
+        }
+        const bool sized = ftruncate(fd, totalBytes) == 0;
+        if (!sized || !map(fd, totalBytes)) {
+            close(fd);
+            shm_unlink(LOOKUP_SEGMENT_NAME);
+            return false;
+        }
+        close(fd);
+
+        header->magic = LOOKUP_MAGIC;
+        header->haystackCount = haystackCount;
+        header->slotCount = slotCount;
+        header->batchCapacity = batchCapacity;
+        header->haystackOffset = haystackOffset;
+        header->slotsOffset = slotsOffset;
+        header->slotBytes = slotBytes;
+        header->totalBytes = totalBytes;
+        header->ready.store(0);
+        header->shutdown.store(0);
+        for (int64_t s = 0; s < slotCount; s++) {
+            LookupSlot &current = slot(s);
+            current.owner.store(0);
+            current.requests.init();
+            current.completions.init();
+        }
+        return true;
+    }
+
+    /// Open a segment made by the server
+    bool open()
+    {
+        const int fd = shm_open(LOOKUP_SEGMENT_NAME, O_RDWR, 0);
+        if (fd < 0) {
+            return false;
+        }
+        LookupHeader probe;
+        const bool readOk = pread(fd, &probe, sizeof(probe), 0) == sizeof(probe);
+        if (!readOk || probe.magic != LOOKUP_MAGIC || !map(fd, probe.totalBytes)) {
+            close(fd);
+            return false;
+        }
+        close(fd);
+        return true;
+    }
+
+    /// Remove the segment name, existing mappings stay valid
+    static void unlink()
+    {
+        shm_unlink(LOOKUP_SEGMENT_NAME);
+    }
+
+    int *haystack()
+    {
+        return reinterpret_cast<int *>(base + header->haystackOffset);
+    }
+
+    LookupSlot &slot(int64_t index)
+    {
+        return *reinterpret_cast<LookupSlot *>(
+            base + header->slotsOffset + index * header->slotBytes);
+    }
+
+    int *needles(int64_t slotIndex, uint32_t buffer)
+    {
+        uint8_t *buffers = reinterpret_cast<uint8_t *>(&slot(slotIndex)) +
+                           alignTo64(sizeof(LookupSlot));
+        return reinterpret_cast<int *>(
+            buffers + buffer * alignTo64(header->batchCapacity * sizeof(int)));
+    }
+
+    int64_t *results(int64_t slotIndex, uint32_t buffer)
+    {
+        uint8_t *buffers = reinterpret_cast<uint8_t *>(needles(slotIndex, 0)) +
+                           LOOKUP_RING_ENTRIES * alignTo64(header->batchCapacity * sizeof(int));
+        return reinterpret_cast<int64_t *>(
+            buffers + buffer * alignTo64(header->batchCapacity * sizeof(int64_t)));
+    }
+
+    /// Claim a free slot for this process
+    /// @return the slot index or -1 if all are taken
+    int64_t claimSlot()
+    {
+        const int pid = int(getpid());
+        for (int64_t s = 0; s < header->slotCount; s++) {
+            int expected = 0;
+            if (slot(s).owner.compare_exchange_strong(expected, pid, std::memory_order_acquire)) {
+                return s;
+            }
+        }
+        return -1;
+    }
+
+    /// Give back a slot claimed by this process, all its batches must be completed
+    void releaseSlot(int64_t index)
+    {
+        slot(index).owner.store(0, std::memory_order_release);
+    }
+
+    /// Free the slots of clients that exited without releasing them, their rings are reset
+    /// Called only by the server, between batches, since it resets the ring it consumes
+    /// @return the number of slots freed
+    int64_t reclaimDeadSlots()
+    {
+        int64_t reclaimed = 0;
+        for (int64_t s = 0; s < header->slotCount; s++) {
+            LookupSlot &current = slot(s);
+            // a dead owner can't release the slot, so nobody else changes it from here on
+            const int owner = current.owner.load(std::memory_order_acquire);
+            if (owner <= 0 || !processExited(owner)) {
+                continue;
+            }
+            current.requests.init();
+            current.completions.init();
+            current.owner.store(0, std::memory_order_release);
+            ++reclaimed;
+        }
+        return reclaimed;
+    }
+
+    LookupHeader *header = nullptr;
+
+private:
+    bool map(int fd, int64_t bytes)
+    {
+        void *mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        base = static_cast<uint8_t *>(mapped);
+        mappedBytes = bytes;
+        header = reinterpret_cast<LookupHeader *>(base);
+        return true;
+    }
+
+    uint8_t *base = nullptr;
+    int64_t mappedBytes = 0;
+};
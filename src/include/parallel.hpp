@@ -0,0 +1,220 @@
+#pragma once
+
+#include "utils.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <thread>
+#include <vector>
+
+/// Inputs smaller than this are sorted and indexed on the calling thread
+const int64_t ParallelMinCount = 1 << 20;
+/// Bins with fewer levels are built on the calling thread, spawning threads costs more
+const int ParallelMinBinSteps = 12;
+
+/// Number of threads used when a parallel function is called with threadCount = 0
+inline int hardwareThreads() {
+	return std::max(1, int(std::thread::hardware_concurrency()));
+}
+
+/// Split [0, @count) in @threadCount contiguous ranges and call @func(begin, end) for each
+/// The first range runs on the calling thread, returns after all ranges are done
+/// @param threadCount - 0 for hardwareThreads()
+template <typename Func>
+void parallelFor(int64_t count, Func func, int threadCount = 0) {
+	const int threads = int(std::min<int64_t>(threadCount > 0 ? threadCount : hardwareThreads(), count));
+	if (threads <= 1) {
+		if (count > 0) {
+			func(int64_t(0), count);
+		}
+		return;
+	}
+
+	std::vector<std::thread> workers;
+	workers.reserve(threads - 1);
+	for (int t = 1; t < threads; t++) {
+		workers.emplace_back(func, count * t / threads, count * (t + 1) / threads);
+	}
+	func(int64_t(0), count / threads);
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+}
+
+/// Sort [@begin, @end) with std::sort on one chunk per thread, then merge the chunks in pairs
+/// with all merges of a round running in parallel
+/// @param threadCount - 0 for hardwareThreads()
+template <typename T>
+void parallelSort(T *begin, T *end, int threadCount = 0) {
+	const int64_t count = end - begin;
+	const int chunks = threadCount > 0 ? threadCount : hardwareThreads();
+	if (chunks <= 1 || count < ParallelMinCount) {
+		std::sort(begin, end);
+		return;
+	}
+
+	std::vector<T *> bounds(chunks + 1);
+	for (int c = 0; c <= chunks; c++) {
+		bounds[c] = begin + count * c / chunks;
+	}
+
+	parallelFor(chunks, [&](int64_t first, int64_t last) {
+		for (int64_t c = first; c < last; c++) {
+			std::sort(bounds[c], bounds[c + 1]);
+		}
+	}, chunks);
+
+	for (int width = 1; width < chunks; width *= 2) {
+		const int merges = (chunks + 2 * width - 1) / (2 * width);
+		parallelFor(merges, [&](int64_t first, int64_t last) {
+			for (int64_t m = first; m < last; m++) {
+				const int left = int(m) * 2 * width;
+				if (left + width < chunks) {
+					std::inplace_merge(bounds[left], bounds[left + width], bounds[std::min(left + 2 * width, chunks)]);
+				}
+			}
+		}, merges);
+	}
+}
+
+namespace {
+	/// Fill the bin nodes above @depth and store the haystack range under each node at @depth
+	void precomputeBinTop(
+		const int *hayStack,
+		const int64_t size,
+		int *bin,
+		const int depth,
+		const int **subtreeStart,
+		int64_t *subtreeSize,
+		int step = 0,
+		int binIdx = 1) {
+		if (step == depth) {
+			subtreeStart[binIdx - (1 << depth)] = hayStack;
+			subtreeSize[binIdx - (1 << depth)] = size;
+			return;
+		}
+
+		const int64_t half = size / 2;
+		bin[binIdx] = hayStack[half];
+		precomputeBinTop(hayStack, half, bin, depth, subtreeStart, subtreeSize, step + 1, binIdx * 2);
+		precomputeBinTop(hayStack + half + 1, size - half - 1, bin, depth, subtreeStart, subtreeSize, step + 1, binIdx * 2 + 1);
+	}
+}
+
+/// Same result as precomputeBin, the levels below the top log2(threads) are built in parallel
+/// Small haystacks and small bins are built on the calling thread
+/// @param threadCount - 0 for hardwareThreads()
+void parallelPrecomputeBin(const int *hayStack, const int64_t size, int *bin, const int stepCount, int threadCount = 0) {
+	const int threads = threadCount > 0 ? threadCount : hardwareThreads();
+	if (threads <= 1 || size < ParallelMinCount || stepCount < ParallelMinBinSteps) {
+		precomputeBin(hayStack, size, bin, stepCount);
+		return;
+	}
+
+	// one subtree per thread, the subtree roots must still be in the bin
+	const int depth = std::min(int(std::bit_width(unsigned(threads - 1))), stepCount - 1);
+	const int subtrees = 1 << depth;
+	std::vector<const int *> subtreeStart(subtrees);
+	std::vector<int64_t> subtreeSize(subtrees);
+	precomputeBinTop(hayStack, size, bin, depth, subtreeStart.data(), subtreeSize.data());
+
+	parallelFor(subtrees, [&](int64_t first, int64_t last) {
+		for (int64_t s = first; s < last; s++) {
+			precomputeBin(subtreeStart[s], subtreeSize[s], bin, stepCount, depth, int(s) + subtrees);
+		}
+	}, threads);
+}
+
+/// Result of parallelVerify
+struct VerifyResult {
+	/// Smallest needle index with a wrong result, -1 if all results are correct
+	int64_t firstMismatch = -1;
+	int64_t mismatchCount = 0;
+};
+
+/// Same check as verify, done as a merge of the sorted needles with the haystack
+/// Needles are sorted with their index, then each thread takes a slice of the sorted needles and
+/// walks the haystack with galloping steps, so a slice costs O(m log(n / m)) instead of O(m log n)
+/// @param threadCount - 0 for hardwareThreads()
+VerifyResult parallelVerify(const AlignedIntArray &hayStack, const AlignedIntArray &needles, const AlignedIndexArray &indices, int threadCount = 0) {
+	const int64_t haystackCount = hayStack.getCount();
+	const int64_t needlesCount = needles.getCount();
+	const int threads = threadCount > 0 ? threadCount : hardwareThreads();
+
+	struct Item {
+		int value;
+		int64_t index;
+		bool operator<(const Item &other) const {
+			return value < other.value || (value == other.value && index < other.index);
+		}
+	};
+	std::vector<Item> sorted(needlesCount);
+	parallelFor(needlesCount, [&](int64_t begin, int64_t end) {
+		for (int64_t c = begin; c < end; c++) {
+			sorted[c] = {needles[c], c};
+		}
+	}, threads);
+	// batches are often generated in order, they are already merged
+	if (!std::is_sorted(needles.begin(), needles.end())) {
+		parallelSort(sorted.data(), sorted.data() + needlesCount, threads);
+	}
+
+	std::vector<VerifyResult> results(threads);
+	parallelFor(threads, [&](int64_t firstSlice, int64_t lastSlice) {
+		for (int64_t t = firstSlice; t < lastSlice; t++) {
+			VerifyResult &result = results[t];
+			const int64_t begin = needlesCount * t / threads;
+			const int64_t end = needlesCount * (t + 1) / threads;
+			if (begin == end) {
+				continue;
+			}
+
+			int64_t pos = std::lower_bound(hayStack.begin(), hayStack.end(), sorted[begin].value) - hayStack.begin();
+			for (int64_t c = begin; c < end; c++) {
+				const int value = sorted[c].value;
+				// gallop to a range that holds the lower bound, then binary search it
+				int64_t step = 1;
+				while (pos + step <= haystackCount && hayStack[pos + step - 1] < value) {
+					pos += step;
+					step *= 2;
+				}
+				pos = std::lower_bound(hayStack.begin() + pos, hayStack.begin() + std::min(pos + step, haystackCount), value) - hayStack.begin();
+
+				const int64_t expected = pos < haystackCount && hayStack[pos] == value ? pos : NOT_FOUND;
+				if (indices[sorted[c].index] != expected) {
+					if (result.firstMismatch == -1 || sorted[c].index < result.firstMismatch) {
+						result.firstMismatch = sorted[c].index;
+					}
+					++result.mismatchCount;
+				}
+			}
+		}
+	}, threads);
+
+	VerifyResult total;
+	for (const VerifyResult &result : results) {
+		if (result.firstMismatch != -1 && (total.firstMismatch == -1 || result.firstMismatch < total.firstMismatch)) {
+			total.firstMismatch = result.firstMismatch;
+		}
+		total.mismatchCount += result.mismatchCount;
+	}
+	return total;
+}
+
+/// Result of timeVerifiedSearch
+struct VerifiedRun {
+	/// Fastest run in nanoseconds
+	uint64_t bestNsec = 0;
+	/// True if parallelVerify found no mismatch
+	bool ok = false;
+};
+
+/// Time @search with bestRunNsec, @indices are reset to NOT_SEARCHED before each run and the
+/// results of the last run are checked with parallelVerify
+template <typename Search>
+VerifiedRun timeVerifiedSearch(int repeat, const AlignedIntArray &hayStack, const AlignedIntArray &needles, AlignedIndexArray &indices, Search &&search) {
+	VerifiedRun run;
+	run.bestNsec = bestRunNsec(repeat, search, [&] { indices.memset(NOT_SEARCHED); });
+	run.ok = parallelVerify(hayStack, needles, indices).firstMismatch == -1;
+	return run;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "utils.hpp"
+
+#ifndef __clang__
+#include <immintrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+#include <cstdio>
+
+/// Stats policy of the instrumented solutions, every call is empty and compiles to nothing
+struct NoStats {
+	static constexpr bool enabled = false;
+
+	static uint64_t now() { return 0; }
+	static void simdNeedles(int64_t) {}
+	static void serialNeedles(int64_t) {}
+	static void shortcutNeedles(int64_t) {}
+	static void rangeRejects(int64_t) {}
+	static void filterRejects(int64_t) {}
+	static void steps(int, int, int64_t) {}
+	static void sortCycles(uint64_t) {}
+	static void scatterCycles(uint64_t) {}
+};
+
+/// Stats policy that counts where the needles and the cycles of a solution go
+/// Counters are shared by all solutions, reset them before each measured call
+struct SearchStats {
+	static constexpr bool enabled = true;
+	static constexpr int MaxSteps = 64;
+
+	static inline int64_t simdNeedleCount = 0;
+	static inline int64_t serialNeedleCount = 0;
+	/// Needles sent around the traversal: one value haystacks, small haystacks that are scanned
+	/// and haystacks too big for 32 bit lanes
+	static inline int64_t shortcutNeedleCount = 0;
+	static inline int64_t rangeRejectCount = 0;
+	static inline int64_t filterRejectCount = 0;
+	/// Needles by the number of steps they took in the bin and in the haystack
+	static inline int64_t binStepHistogram[MaxSteps + 1] = {};
+	static inline int64_t haystackStepHistogram[MaxSteps + 1] = {};
+	static inline uint64_t sortCycleCount = 0;
+	static inline uint64_t scatterCycleCount = 0;
+
+	static uint64_t now() { return __rdtsc(); }
+	static void simdNeedles(int64_t count) { simdNeedleCount += count; }
+	static void serialNeedles(int64_t count) { serialNeedleCount += count; }
+	static void shortcutNeedles(int64_t count) { shortcutNeedleCount += count; }
+	static void rangeRejects(int64_t count) { rangeRejectCount += count; }
+	static void filterRejects(int64_t count) { filterRejectCount += count; }
+	static void steps(int binSteps, int haystackSteps, int64_t count) {
+		binStepHistogram[std::min(binSteps, MaxSteps)] += count;
+		haystackStepHistogram[std::min(haystackSteps, MaxSteps)] += count;
+	}
+	static void sortCycles(uint64_t cycles) { sortCycleCount += cycles; }
+	static void scatterCycles(uint64_t cycles) { scatterCycleCount += cycles; }
+
+	static void reset() {
+		simdNeedleCount = serialNeedleCount = shortcutNeedleCount = 0;
+		rangeRejectCount = filterRejectCount = 0;
+		sortCycleCount = scatterCycleCount = 0;
+		for (int s = 0; s <= MaxSteps; s++) {
+			binStepHistogram[s] = haystackStepHistogram[s] = 0;
+		}
+	}
+
+	/// Print the counters of a call that took @totalCycles and searched @needlesCount needles
+	static void print(int64_t needlesCount, uint64_t totalCycles) {
+		const double needles = double(std::max<int64_t>(1, needlesCount));
+		printf("  needles: simd %.1f%%, serial %.1f%%, shortcut %.1f%%, range check rejects %.1f%%, filter rejects %.1f%%\n",
+			100 * simdNeedleCount / needles,
+			100 * serialNeedleCount / needles,
+			100 * shortcutNeedleCount / needles,
+			100 * rangeRejectCount / needles,
+			100 * filterRejectCount / needles);
+		printHistogram("  bin steps:", binStepHistogram);
+		printHistogram("  haystack steps:", haystackStepHistogram);
+		const double cycles = double(std::max<uint64_t>(1, totalCycles));
+		printf("  cycles: sort %.1f%%, scatter writeback %.1f%%\n",
+			100 * sortCycleCount / cycles,
+			100 * scatterCycleCount / cycles);
+	}
+
+private:
+	/// Share of the searched needles for each step count that was taken
+	static void printHistogram(const char *name, const int64_t *histogram) {
+		int64_t total = 0;
+		for (int s = 0; s <= MaxSteps; s++) {
+			total += histogram[s];
+		}
+		printf("%s", name);
+		for (int s = 0; s <= MaxSteps; s++) {
+			if (histogram[s]) {
+				printf(" %d:%.1f%%", s, 100.0 * histogram[s] / total);
+			}
+		}
+		printf("\n");
+	}
+};
@@ -4,10 +4,202 @@
 #include "solutions/simd-avx256.hpp"
 #include "solutions/eytzinger.hpp"
 #include "solutions/stl.hpp"
+#include "solutions/compressed.hpp"
+#include "solutions/prefix-table.hpp"
+#include "solutions/tiled.hpp"
+#include "solutions/unrolled.hpp"
+#include "solutions/kary.hpp"
+#include "solutions/sharded.hpp"
+#include "solutions/hot-keys.hpp"
 
 #define TEST_SEARCH eytzingerSearch<15>
 
 #define STRINGIZE2(a) #a
 #define STRINGIZE(a) STRINGIZE2(a)
 
-#define TEST_NAME STRINGIZE(TEST_SEARCH)
\ No newline at end of file
+#define TEST_NAME STRINGIZE(TEST_SEARCH)
+
+typedef void (*SearchFunction)(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator);
+
+namespace {
+struct SolutionInfo {
+    const char *name;
+    SearchFunction search;
+};
+
+/// Solution that searches an index built once per haystack, tools time the build apart from the
+/// searches
+/// The index type has init(hayStack), search(needles, indices, allocator) const and
+/// memoryBytes() const, an index that reads the haystack keeps a pointer to it
+/// An index that learns from past lookups has init(hayStack, queryLog) instead
+struct IndexedSolutionInfo {
+    const char *name;
+    /// @param queryLog - optional sample of the lookups, ignored by the indexes that don't use it
+    /// @return a new index of @hayStack, released with destroy
+    void *(*build)(const AlignedIntArray &hayStack, const AlignedIntArray *queryLog);
+    void (*search)(const void *index,
+        const AlignedIntArray &needles,
+        AlignedIndexArray &indices,
+        ArenaAllocator &allocator);
+    int64_t (*memoryBytes)(const void *index);
+    void (*destroy)(void *index);
+};
+
+template <typename Index>
+constexpr IndexedSolutionInfo indexedSolution(const char *name)
+{
+    return {
+        name,
+        [](const AlignedIntArray &hayStack, const AlignedIntArray *queryLog) -> void * {
+            Index *index = new Index();
+            if constexpr (requires { index->init(hayStack, queryLog); }) {
+                index->init(hayStack, queryLog);
+            } else {
+                index->init(hayStack);
+            }
+            return index;
+        },
+        [](const void *index,
+            const AlignedIntArray &needles,
+            AlignedIndexArray &indices,
+            ArenaAllocator &allocator) {
+            static_cast<const Index *>(index)->search(needles, indices, allocator);
+        },
+        [](const void *index) { return static_cast<const Index *>(index)->memoryBytes(); },
+        [](void *index) { delete static_cast<Index *>(index); },
+    };
+}
+
+/// Traversal with all three outputs: the indices, a bitmap of the needles found and their count
+struct OutputModeInfo {
+    const char *name;
+    SearchFunction search;
+    /// @param bits - (needles.count + 7) / 8 bytes, bit c is set when needles[c] is found
+    void (*bitmap)(const AlignedIntArray &hayStack,
+        const AlignedIntArray &needles,
+        uint8_t *bits,
+        ArenaAllocator &allocator);
+    int64_t (*count)(
+        const AlignedIntArray &hayStack, const AlignedIntArray &needles, ArenaAllocator &allocator);
+};
+
+/// Index of an IndexedSolutionInfo, built in the constructor and released in the destructor
+struct BuiltIndex {
+    BuiltIndex(const IndexedSolutionInfo &newSolution,
+        const AlignedIntArray &hayStack,
+        const AlignedIntArray *queryLog = nullptr)
+        : solution(newSolution)
+        , index(newSolution.build(hayStack, queryLog))
+    {
+    }
+
+    ~BuiltIndex()
+    {
+        solution.destroy(index);
+    }
+
+    BuiltIndex(const BuiltIndex &) = delete;
+    BuiltIndex &operator=(const BuiltIndex &) = delete;
+
+    void search(
+        const AlignedIntArray &needles, AlignedIndexArray &indices, ArenaAllocator &allocator) const
+    {
+        solution.search(index, needles, indices, allocator);
+    }
+
+    int64_t memoryBytes() const
+    {
+        return solution.memoryBytes(index);
+    }
+
+    const IndexedSolutionInfo &solution;
+    void *index;
+};
+} // namespace
+
+/// Every solution with the common signature, used by tools that compare all of them
+const SolutionInfo allSolutions[] = {
+    {"binarySearch", binarySearch},
+    {"stlLowerBound", stlLowerBound},
+    {"stlLowerBoundTransform", stlLowerBoundTransform},
+    {"stlRanges", stlRanges},
+    {"eytzingerSearch<10>", eytzingerSearch<10>},
+    {"eytzingerSearch<15>", eytzingerSearch<15>},
+    {"eytzingerSearchRangeCheck<10>", eytzingerSearchRangeCheck<10>},
+    {"eytzingerSearchRangeCheck<15>", eytzingerSearchRangeCheck<15>},
+    {"avx256", avx256},
+    {"avx256LinearScan", avx256LinearScan},
+    {"avx256Eytzinger<15>", avx256Eytzinger<15>},
+    {"avx256EytzingerRangeCheck<15, 128>", avx256EytzingerRangeCheck<15, 128>},
+    {"binarySearchTiled<12>", binarySearchTiled<12>},
+    {"avx256Tiled<12>", avx256Tiled<12>},
+    {"binarySearchUnrolled", binarySearchUnrolled},
+    {"avx256Unrolled", avx256Unrolled},
+    {"avx256KarySearch<1>", avx256KarySearch<1>},
+    {"avx256KarySearch<8>", avx256KarySearch<8>},
+    {"parallelBinarySearch", parallelBinarySearch},
+    {"parallelAvx256", parallelAvx256},
+    {"binarySearchSharded", binarySearchSharded},
+    {"avx256Sharded", avx256Sharded},
+};
+
+/// Solutions with an index built once per haystack
+const IndexedSolutionInfo indexedSolutions[] = {
+    indexedSolution<EytzingerSearch<15>>("EytzingerSearch<15>"),
+    indexedSolution<Avx256EytzingerSearch<15>>("Avx256EytzingerSearch<15>"),
+    indexedSolution<BlockCompressedSearch<12>>("BlockCompressedSearch<12>"),
+    indexedSolution<Avx256PrefilterSearch<15, 128>>("Avx256PrefilterSearch<15, 128>"),
+    indexedSolution<PrefixTableSearch>("PrefixTableSearch"),
+    indexedSolution<Avx256PrefixTableSearch>("Avx256PrefixTableSearch"),
+    indexedSolution<Avx256HotKeySearch>("Avx256HotKeySearch"),
+};
+
+/// Indexed solutions built with the SearchStats policy
+const IndexedSolutionInfo instrumentedIndexedSolutions[] = {
+    indexedSolution<Avx256PrefilterSearch<15, 128, SearchStats>>("Avx256PrefilterSearch<15, 128>"),
+};
+
+/// Solutions built with the SearchStats policy, speed-test prints their counters
+const SolutionInfo instrumentedSolutions[] = {
+    {"eytzingerSearch<15>", eytzingerSearch<15, SearchStats>},
+    {"avx256Eytzinger<15>", avx256Eytzinger<15, SearchStats>},
+    {"avx256EytzingerRangeCheck<15, 128>", avx256EytzingerRangeCheck<15, 128, SearchStats>},
+};
+
+/// Solutions that write through the output policies, speed-test compares their three modes
+const OutputModeInfo outputModes[] = {
+    {
+        "avx256",
+        avx256,
+        [](const AlignedIntArray &hayStack,
+            const AlignedIntArray &needles,
+            uint8_t *bits,
+            ArenaAllocator &allocator) {
+            BitmapWriter writer{bits};
+            avx256Write(hayStack, needles, writer, allocator);
+        },
+        [](const AlignedIntArray &hayStack,
+            const AlignedIntArray &needles,
+            ArenaAllocator &allocator) {
+            CountWriter writer;
+            avx256Write(hayStack, needles, writer, allocator);
+            return writer.hits;
+        },
+    },
+    {
+        "avx256Eytzinger<15>",
+        avx256Eytzinger<15>,
+        avx256EytzingerBitmap<15>,
+        avx256EytzingerCount<15>,
+    },
+    {
+        "avx256EytzingerRangeCheck<15, 128>",
+        avx256EytzingerRangeCheck<15, 128>,
+        avx256EytzingerRangeCheckBitmap<15, 128>,
+        avx256EytzingerRangeCheckCount<15, 128>,
+    },
+};
@@ -1,9 +1,19 @@
 #pragma once
 
 #include <cstdio>
+#include <cassert>
 #include <cstdint>
+#include <cstring>
+#include <functional>
 #include <new>
 #include <memory>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+#if __linux__ != 0
+#include <sys/mman.h>
+#endif
 
 const int NOT_FOUND = -1;
 const int NOT_SEARCHED = -2;
@@ -84,6 +94,25 @@ namespace {
 
 #endif
 
+	/// Run @run @repeat times, @prepare is called before each run outside of the timing
+	/// @return the fastest run in nanoseconds
+	template <typename Run, typename Prepare>
+	uint64_t bestRunNsec(int repeat, Run &&run, Prepare &&prepare) {
+		uint64_t best = -1;
+		for (int r = 0; r < repeat; r++) {
+			prepare();
+			const uint64_t start = timer_nsec();
+			run();
+			best = std::min(best, timer_nsec() - start);
+		}
+		return best;
+	}
+
+	template <typename Run>
+	uint64_t bestRunNsec(int repeat, Run &&run) {
+		return bestRunNsec(repeat, run, [] {});
+	}
+
 	/// Allocate aligned for @count objects of type T, does not perform initialization
 	/// @param count - the number of objects
 	/// @param unaligned [out] - stores the un-aligned pointer, used to call free
@@ -103,15 +132,15 @@ namespace {
 	struct AlignedArrayPtr {
 		void *allocated = nullptr;
 		T *aligned = nullptr;
-		int count = -1;
+		int64_t count = -1;
 
 		AlignedArrayPtr() = default;
 
-		AlignedArrayPtr(int count) {
+		AlignedArrayPtr(int64_t count) {
 			init(count);
 		}
 
-		void init(int newCount) {
+		void init(int64_t newCount) {
 			bassert(newCount > 0);
 			free(allocated);
 			aligned = alignedAlloc<T>(newCount, allocated);
@@ -122,6 +151,14 @@ namespace {
 			::memset(aligned, value, sizeof(T) * count);
 		}
 
+		/// Point to @newCount elements owned by someone else, they are not freed by this array
+		void view(T *ptr, int64_t newCount) {
+			free(allocated);
+			allocated = nullptr;
+			aligned = ptr;
+			count = newCount;
+		}
+
 		~AlignedArrayPtr() {
 			free(allocated);
 		}
@@ -142,7 +179,7 @@ namespace {
 			return aligned;
 		}
 
-		int getCount() const {
+		int64_t getCount() const {
 			return count;
 		}
 
@@ -162,13 +199,13 @@ namespace {
 			return aligned + count;
 		}
 
-		int operator[](int index) const {
+		T operator[](int64_t index) const {
 			bassert(index >= 0);
 			bassert(index < count);
 			return aligned[index];
 		}
 
-		int &operator[](int index) {
+		T &operator[](int64_t index) {
 			return aligned[index];
 		}
 
@@ -178,6 +215,9 @@ namespace {
 
 	typedef AlignedArrayPtr<int> AlignedIntArray;
 
+	/// Results of a search, 64 bit so haystacks can have more than 2^31 elements
+	typedef AlignedArrayPtr<int64_t> AlignedIndexArray;
+
 	const char magic[] = ".BSEARCH";
 	const int magicSize = sizeof(magic) - 1;
 
@@ -228,11 +268,11 @@ namespace {
 	/// @param needles - the values that will be searched
 	/// @param indices - the indices of the needles (or -1 if the needle is not found)
 	/// Return the first index @c where find(@hayStack, @needles[@c]) != @indices[@c], or -1 if all indices are correct
-	int verify(const AlignedIntArray &hayStack, const AlignedIntArray &needles, const AlignedIntArray &indices) {
-		for (int c = 0; c < needles.getCount(); c++) {
+	int64_t verify(const AlignedIntArray &hayStack, const AlignedIntArray &needles, const AlignedIndexArray &indices) {
+		for (int64_t c = 0; c < needles.getCount(); c++) {
 			const int value = needles[c];
 			const int *pos = std::lower_bound(hayStack.begin(), hayStack.end(), value);
-			const int idx = std::distance(hayStack.begin(), pos);
+			const int64_t idx = std::distance(hayStack.begin(), pos);
 
 			if (idx == hayStack.getCount() || hayStack[idx] != value) {
 				bassert(indices[c] == NOT_FOUND);
@@ -249,61 +289,289 @@ namespace {
 		return -1;
 	}
 
+	/// One search of a test tool, @run writes its results where the verifier reads them
+	struct TimedMethod {
+		const char *name;
+		std::function<void()> run;
+	};
+
+	/// Run each of @methods once and check it with @verify, the ones that pass are timed with
+	/// bestRunNsec and printed in ns per needle, as timeVerifiedSearch does for the int solutions
+	/// @param indices - output of the methods, reset to NOT_SEARCHED before the checked run
+	/// @param verify - returns the first needle with a wrong index or -1
+	/// @return false if a method failed the check
+	template <typename Verify>
+	bool timeVerifiedMethods(int repeat, int64_t needlesCount, std::initializer_list<TimedMethod> methods, AlignedIndexArray &indices, Verify &&verify) {
+		int nameWidth = 0;
+		for (const TimedMethod &method : methods) {
+			nameWidth = std::max(nameWidth, int(strlen(method.name)));
+		}
+
+		bool passed = true;
+		for (const TimedMethod &method : methods) {
+			indices.memset(NOT_SEARCHED);
+			method.run();
+			const int64_t mismatch = verify();
+			if (mismatch != -1) {
+				printf("%-*s FAILED at needle %lld\n", nameWidth, method.name, (long long)mismatch);
+				passed = false;
+				continue;
+			}
+
+			const uint64_t best = bestRunNsec(repeat, method.run);
+			printf("%-*s %f ns per needle\n", nameWidth, method.name, double(best) / needlesCount);
+		}
+		return passed;
+	}
+
 }
 
-/// Stack allocator with predefined max size
-/// The total memory is 64 byte aligned, all but the first allocation are not guaranteed to be algigned
-/// Can only free all the allocations at once
-struct StackAllocator {
-	StackAllocator(uint8_t *ptr, int bytes)
-		: totalBytes(bytes)
-		, data(ptr) {
+/// Bump allocator that grows in chunks and never moves an allocation
+/// Every allocation is 64 byte aligned, so SIMD scratch can use aligned loads
+/// Memory is released in LIFO order with a Scope (or mark/release), or all at once with freeAll
+/// Chunks are at least ChunkBytes, 2MB aligned and advised for transparent huge pages on Linux
+/// Not thread safe, each thread should use its own arena from threadArena() or workerArenas()
+struct ArenaAllocator {
+	static const size_t Alignment = 64;
+	static const size_t HugePageBytes = size_t(2) << 20;
+	static constexpr size_t ChunkBytes = size_t(16) << 20;
+
+	/// Position of the arena, everything allocated after it is freed by release
+	struct Mark {
+		size_t chunk = 0;
+		size_t offset = 0;
+		size_t used = 0;
+	};
+
+	/// Free everything allocated in the lifetime of the scope
+	struct Scope {
+		explicit Scope(ArenaAllocator &arena)
+			: arena(arena)
+			, saved(arena.mark()) {
+		}
+
+		~Scope() {
+			arena.release(saved);
+		}
+
+		Scope(const Scope &) = delete;
+		Scope &operator=(const Scope &) = delete;
+	private:
+		ArenaAllocator &arena;
+		const Mark saved;
+	};
+
+	ArenaAllocator() = default;
+
+	~ArenaAllocator() {
+		for (Chunk &chunk : chunks) {
+			freeChunk(chunk);
+		}
 	}
 
-	/// Allocate memory for @count T objects
+	/// Allocate memory for @count T objects, 64 byte aligned
 	/// Does *NOT* call constructors
 	/// @param count - the number of objects needed
-	/// @return pointer to the allocated memory or nullptr
+	/// @return pointer to the allocated memory or nullptr if the system is out of memory
 	template <typename T>
-	T *alloc(int count) {
-		const int size = count * sizeof(T);
-		if (idx + size > totalBytes) {
-			return nullptr;
+	T *alloc(size_t count) {
+		const size_t size = std::max<size_t>(count * sizeof(T), 1);
+		size_t start = (offset + Alignment - 1) & ~(Alignment - 1);
+		if (chunks.empty() || start + size > chunks[current].bytes) {
+			if (!nextChunk(size)) {
+				return nullptr;
+			}
+			start = 0;
 		}
-		uint8_t *start = data + idx;
-		idx += size;
-		return reinterpret_cast<T *>(start);
+		used += start - offset + size;
+		highWater = std::max(highWater, used);
+		offset = start + size;
+		return reinterpret_cast<T *>(chunks[current].data + start);
+	}
+
+	Mark mark() const {
+		return Mark{current, offset, used};
 	}
 
-	/// De-allocate all the memory previously allocated with @alloc
+	/// Free everything allocated after @saved was taken
+	void release(const Mark &saved) {
+		current = saved.chunk;
+		offset = saved.offset;
+		used = saved.used;
+	}
+
+	/// De-allocate all the memory previously allocated with @alloc, the chunks are kept
 	void freeAll() {
-		idx = 0;
+		release(Mark{});
 	}
 
-	/// Get the max number of bytes that can be allocated by the allocator
-	int maxBytes() const {
-		return totalBytes;
+	/// Most bytes in use at the same time, including alignment padding
+	size_t highWaterBytes() const {
+		return highWater;
 	}
 
-	/// Get the free space that can still be allocated, same as maxBytes before any allocations
-	int freeBytes() const {
-		return totalBytes - idx;
+	void resetHighWater() {
+		highWater = used;
+	}
+
+	/// Bytes in use right now
+	size_t usedBytes() const {
+		return used;
+	}
+
+	/// Bytes taken from the system
+	size_t reservedBytes() const {
+		size_t total = 0;
+		for (const Chunk &chunk : chunks) {
+			total += chunk.bytes;
+		}
+		return total;
+	}
+
+	/// Take at least @bytes from the system and touch them, so page faults are out of the timed code
+	void reserve(size_t bytes) {
+		const Mark saved = mark();
+		alloc<uint8_t>(bytes);
+		release(saved);
+		zeroAll();
 	}
 
 	void zeroAll() const {
-		memset(data, 0, totalBytes);
+		for (const Chunk &chunk : chunks) {
+			memset(chunk.data, 0, chunk.bytes);
+		}
 	}
 
-	StackAllocator(const StackAllocator &) = delete;
-	StackAllocator &operator=(const StackAllocator &) = delete;
+	ArenaAllocator(const ArenaAllocator &) = delete;
+	ArenaAllocator &operator=(const ArenaAllocator &) = delete;
 private:
-	const int totalBytes;
-	int idx = 0;
-	uint8_t *data = nullptr;
+	struct Chunk {
+		uint8_t *data = nullptr;
+		size_t bytes = 0;
+		/// What was mapped or allocated, data is aligned inside it
+		void *base = nullptr;
+		size_t baseBytes = 0;
+	};
+
+	std::vector<Chunk> chunks;
+	size_t current = 0;
+	size_t offset = 0;
+	size_t used = 0;
+	size_t highWater = 0;
+
+	/// Move to the chunk after the current one, inserting a new one if it can't fit @size bytes
+	bool nextChunk(size_t size) {
+		const size_t next = chunks.empty() ? 0 : current + 1;
+		if (next == chunks.size() || chunks[next].bytes < size) {
+			Chunk chunk;
+			if (!allocChunk(chunk, std::max(ChunkBytes, size))) {
+				return false;
+			}
+			chunks.insert(chunks.begin() + next, chunk);
+		}
+		// the rest of the current chunk is skipped until the mark before it is released
+		if (!chunks.empty() && next != 0) {
+			used += chunks[current].bytes - std::min(offset, chunks[current].bytes);
+		}
+		current = next;
+		offset = 0;
+		return true;
+	}
+
+	static bool allocChunk(Chunk &chunk, size_t bytes) {
+		chunk.bytes = (bytes + HugePageBytes - 1) & ~(HugePageBytes - 1);
+#if __linux__ != 0
+		chunk.baseBytes = chunk.bytes + HugePageBytes;
+		chunk.base = mmap(nullptr, chunk.baseBytes, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (chunk.base == MAP_FAILED) {
+			return false;
+		}
+		const uintptr_t start = (uintptr_t(chunk.base) + HugePageBytes - 1) & ~(HugePageBytes - 1);
+		chunk.data = reinterpret_cast<uint8_t *>(start);
+		madvise(chunk.data, chunk.bytes, MADV_HUGEPAGE);
+#else
+		chunk.baseBytes = chunk.bytes;
+		chunk.data = alignedAlloc<uint8_t>(chunk.bytes, chunk.base);
+		if (!chunk.data) {
+			return false;
+		}
+#endif
+		return true;
+	}
+
+	static void freeChunk(Chunk &chunk) {
+#if __linux__ != 0
+		munmap(chunk.base, chunk.baseBytes);
+#else
+		free(chunk.base);
+#endif
+	}
 };
 
-void precomputeBin(const int *hayStack, const int size, int *bin, const int stepCount, int step = 0, int binIdx = 1) {
-	const int half = size / 2;
+/// Arena of the calling thread, solutions that run work on other threads lease one from workerArenas()
+inline ArenaAllocator &threadArena() {
+	thread_local ArenaAllocator arena;
+	return arena;
+}
+
+/// Bytes the tools reserve in the arena of their main thread, so the timed searches do not fault
+/// in its first chunk
+const size_t ARENA_RESERVE_BYTES = (1 << 24) + 1;
+
+/// Arenas that outlive the threads using them
+/// parallelFor starts new threads on every call, so their threadArena() would map and unmap its chunks
+/// per call, a worker leases an arena from the pool instead and the chunks are mapped once per process
+struct ArenaPool {
+	/// Arena taken from the pool in the constructor and given back in the destructor
+	struct Lease {
+		explicit Lease(ArenaPool &pool)
+			: pool(pool)
+			, arena(pool.acquire()) {
+		}
+
+		~Lease() {
+			pool.release(arena);
+		}
+
+		Lease(const Lease &) = delete;
+		Lease &operator=(const Lease &) = delete;
+
+		ArenaPool &pool;
+		ArenaAllocator &arena;
+	};
+
+	ArenaAllocator &acquire() {
+		const std::lock_guard<std::mutex> lock(mutex);
+		if (idle.empty()) {
+			arenas.push_back(std::make_unique<ArenaAllocator>());
+			return *arenas.back();
+		}
+		ArenaAllocator *arena = idle.back();
+		idle.pop_back();
+		return *arena;
+	}
+
+	/// The arena must have nothing allocated, as after a Scope
+	void release(ArenaAllocator &arena) {
+		const std::lock_guard<std::mutex> lock(mutex);
+		idle.push_back(&arena);
+	}
+
+private:
+	std::mutex mutex;
+	std::vector<std::unique_ptr<ArenaAllocator>> arenas;
+	std::vector<ArenaAllocator *> idle;
+};
+
+/// Pool of the arenas used by the workers of parallel solutions
+inline ArenaPool &workerArenas() {
+	static ArenaPool pool;
+	return pool;
+}
+
+void precomputeBin(const int *hayStack, const int64_t size, int *bin, const int stepCount, int step = 0, int binIdx = 1) {
+	const int64_t half = size / 2;
 	bin[binIdx] = hayStack[half];
 
 	if (step + 1 < stepCount) {
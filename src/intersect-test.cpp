@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "utils.hpp"
+#include "solution-picker.hpp"
+#include "solutions/intersect.hpp"
+
+const int TEST_REPEAT = 5;
+
+/// Join @needleSet with the haystack one needle at a time: avx256 finds the first match and the
+/// duplicates after it are scanned, the order of both sides is not used
+int64_t perNeedleJoin(const AlignedIntArray &hayStack, const AlignedIntArray &needleSet, AlignedIndexArray &indices, ArenaAllocator &allocator, MatchPair *buffer, std::vector<MatchPair> *out) {
+	avx256(hayStack, needleSet, indices, allocator);
+	int64_t count = 0;
+	int64_t total = 0;
+	auto flush = [&] {
+		if (out) {
+			out->insert(out->end(), buffer, buffer + count);
+		}
+		total += count;
+		count = 0;
+	};
+	for (int64_t c = 0; c < needleSet.getCount(); c++) {
+		for (int64_t h = indices[c]; h != NOT_FOUND && h < hayStack.getCount() && hayStack[h] == needleSet[c]; h++) {
+			if (count == IntersectBufferPairs) {
+				flush();
+			}
+			buffer[count++] = MatchPair{c, h};
+		}
+	}
+	flush();
+	return total;
+}
+
+/// Time both joins of @needleSet and compare their match pairs
+/// @return true if the pairs are the same
+bool compareJoins(const char *name, const AlignedIntArray &hayStack, const AlignedIntArray &needleSet, ArenaAllocator &allocator) {
+	AlignedIndexArray indices(needleSet.getCount());
+	AlignedArrayPtr<MatchPair> buffer(IntersectBufferPairs);
+
+	std::vector<MatchPair> expected;
+	std::vector<MatchPair> actual;
+	perNeedleJoin(hayStack, needleSet, indices, allocator, buffer, &expected);
+	avx256Intersect(needleSet, hayStack, buffer, IntersectBufferPairs, [&](const MatchPair *pairs, int64_t count) {
+		actual.insert(actual.end(), pairs, pairs + count);
+	});
+	auto byPosition = [](const MatchPair &a, const MatchPair &b) {
+		return a.needleIndex != b.needleIndex ? a.needleIndex < b.needleIndex : a.hayStackIndex < b.hayStackIndex;
+	};
+	std::sort(expected.begin(), expected.end(), byPosition);
+	std::sort(actual.begin(), actual.end(), byPosition);
+	const bool same = expected.size() == actual.size() &&
+		std::equal(expected.begin(), expected.end(), actual.begin(), [](const MatchPair &a, const MatchPair &b) {
+			return a.needleIndex == b.needleIndex && a.hayStackIndex == b.hayStackIndex;
+		});
+
+	const uint64_t bestPerNeedle = bestRunNsec(TEST_REPEAT, [&] {
+		perNeedleJoin(hayStack, needleSet, indices, allocator, buffer, nullptr);
+	});
+	const uint64_t bestIntersect = bestRunNsec(TEST_REPEAT, [&] {
+		int64_t checksum = 0;
+		avx256Intersect(needleSet, hayStack, buffer, IntersectBufferPairs, [&](const MatchPair *pairs, int64_t count) {
+			checksum += pairs[count - 1].hayStackIndex;
+		});
+	});
+
+	printf("  %-16s %lld needles %lld pairs, per needle %f ms, avx256Intersect %f ms%s\n",
+		name,
+		(long long)needleSet.getCount(),
+		(long long)expected.size(),
+		double(bestPerNeedle) * 1e-6,
+		double(bestIntersect) * 1e-6,
+		same ? "" : " FAILED");
+	return same;
+}
+
+/// Compare avx256Intersect with a per needle join on a .bsearch file
+/// The needle sets are the distinct needles of the file (sparse) and every other distinct
+/// haystack value (dense)
+/// usage: intersect-test <file.bsearch>
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		printf("usage: %s <file.bsearch>\n", argv[0]);
+		return -1;
+	}
+
+	AlignedIntArray hayStack;
+	AlignedIntArray needles;
+	if (!loadFromFile(hayStack, needles, argv[1])) {
+		printf("Failed to load %s\n", argv[1]);
+		return -1;
+	}
+	printf("%s: %lld values, %lld needles\n", argv[1], (long long)hayStack.getCount(), (long long)needles.getCount());
+
+	ArenaAllocator &allocator = threadArena();
+	allocator.reserve(ARENA_RESERVE_BYTES);
+
+	std::vector<int> values(needles.begin(), needles.end());
+	std::sort(values.begin(), values.end());
+	values.erase(std::unique(values.begin(), values.end()), values.end());
+	AlignedIntArray sparse(int64_t(values.size()));
+	std::copy(values.begin(), values.end(), sparse.begin());
+
+	values.assign(hayStack.begin(), hayStack.end());
+	values.erase(std::unique(values.begin(), values.end()), values.end());
+	AlignedIntArray dense((int64_t(values.size()) + 1) / 2);
+	for (int64_t c = 0; c < dense.getCount(); c++) {
+		dense[c] = values[c * 2];
+	}
+
+	bool failedTests = !compareJoins("file needles", hayStack, sparse, allocator);
+	failedTests |= !compareJoins("haystack values", hayStack, dense, allocator);
+	return failedTests ? -1 : 0;
+}
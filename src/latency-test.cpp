@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+#include "utils.hpp"
+#include "solutions/single-lookup.hpp"
+#include "solutions/hot-keys.hpp"
+
+/// Bigger than the last level cache, reading it before a lookup evicts the haystack
+const int64_t EVICT_BYTES = 64ll << 20;
+
+/// Print the latency percentiles of @samples, sorts them
+void printLatency(const char *name, const char *cache, AlignedArrayPtr<uint64_t> &samples) {
+	const int64_t count = samples.getCount();
+	std::sort(samples.begin(), samples.end());
+	auto percentile = [&](double p) {
+		return (long long)samples[std::min(count - 1, int64_t(p * count))];
+	};
+	printf("%-16s %-5s p50 %6lld ns  p99 %6lld ns  p999 %6lld ns  max %8lld ns\n",
+		name, cache, percentile(0.5), percentile(0.99), percentile(0.999), (long long)samples[count - 1]);
+}
+
+/// Measure one lookup at a time on a .bsearch file, with warm caches and with the caches evicted
+/// before each lookup
+/// usage: latency-test <file.bsearch> [warmSamples=1000000] [coldSamples=1000]
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		printf("usage: %s <file.bsearch> [warmSamples=1000000] [coldSamples=1000]\n", argv[0]);
+		return -1;
+	}
+	const int64_t warmSamples = argc > 2 ? std::max(1ll, atoll(argv[2])) : 1000000;
+	const int64_t coldSamples = argc > 3 ? std::max(1ll, atoll(argv[3])) : 1000;
+
+	AlignedIntArray hayStack;
+	AlignedIntArray needles;
+	if (!loadFromFile(hayStack, needles, argv[1])) {
+		printf("Failed to load %s\n", argv[1]);
+		return -1;
+	}
+
+	const uint64_t buildStart = timer_nsec();
+	LatencySearch search;
+	search.init(hayStack);
+	const uint64_t buildEnd = timer_nsec();
+
+	// the needles of the file stand in for the query log
+	HotKeySearch hotSearch;
+	hotSearch.init(hayStack, needles.get(), needles.getCount());
+
+	printf("%s: %lld values, %lld needles, %d bin levels built in %f ms\n",
+		argv[1],
+		(long long)hayStack.getCount(),
+		(long long)needles.getCount(),
+		search.binSteps,
+		double(buildEnd - buildStart) * 1e-6);
+
+	AlignedIndexArray indices(needles.getCount());
+	for (int64_t c = 0; c < needles.getCount(); c++) {
+		indices[c] = search.find(needles[c]);
+	}
+	if (verify(hayStack, needles, indices) != -1) {
+		printf("LatencySearch FAILED\n");
+		return -1;
+	}
+	for (int64_t c = 0; c < needles.getCount(); c++) {
+		indices[c] = hotSearch.find(needles[c]);
+	}
+	if (verify(hayStack, needles, indices) != -1) {
+		printf("HotKeySearch FAILED\n");
+		return -1;
+	}
+	printf("%lld hot keys\n", (long long)hotSearch.hot.hotCount);
+
+	struct {
+		const char *name;
+		std::function<int64_t(int)> find;
+	} methods[] = {
+		{"stlLowerBound", [&](int value) {
+			const int *pos = std::lower_bound(hayStack.begin(), hayStack.end(), value);
+			return pos != hayStack.end() && *pos == value ? int64_t(pos - hayStack.begin()) : int64_t(NOT_FOUND);
+		}},
+		{"LatencySearch", [&](int value) { return search.find(value); }},
+		{"HotKeySearch", [&](int value) { return hotSearch.find(value); }},
+	};
+
+	AlignedArrayPtr<uint8_t> evict(EVICT_BYTES);
+	evict.memset(1);
+	volatile int64_t sink = 0;
+
+	// the cost of reading the timer is included in every sample
+	AlignedArrayPtr<uint64_t> samples(warmSamples);
+	for (int64_t s = 0; s < warmSamples; s++) {
+		const uint64_t start = timer_nsec();
+		samples[s] = timer_nsec() - start;
+	}
+	printLatency("timer", "", samples);
+
+	for (const auto &method : methods) {
+		// one pass over the needles to bring the haystack and the bin in cache
+		for (int64_t c = 0; c < std::min(warmSamples, needles.getCount()); c++) {
+			sink = sink + method.find(needles[c]);
+		}
+		samples.init(warmSamples);
+		for (int64_t s = 0; s < warmSamples; s++) {
+			const int value = needles[s % needles.getCount()];
+			const uint64_t start = timer_nsec();
+			sink = sink + method.find(value);
+			samples[s] = timer_nsec() - start;
+		}
+		printLatency(method.name, "warm", samples);
+
+		samples.init(coldSamples);
+		for (int64_t s = 0; s < coldSamples; s++) {
+			uint64_t evictSum = 0;
+			for (int64_t c = 0; c < EVICT_BYTES; c += 64) {
+				evictSum += evict[c];
+			}
+			sink = sink + evictSum;
+
+			const int value = needles[s % needles.getCount()];
+			const uint64_t start = timer_nsec();
+			sink = sink + method.find(value);
+			samples[s] = timer_nsec() - start;
+		}
+		printLatency(method.name, "cold", samples);
+	}
+	return 0;
+}
@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "utils.hpp"
+#include "lookup-service.hpp"
+
+/// Results of one client process, written in memory shared with the parent
+struct ClientStats {
+	int64_t mismatches;
+	int64_t completed;
+};
+
+/// Submit @batchCount batches of @batchSize needles with up to @inFlight outstanding
+/// Half of the needles are picked from the haystack, half are uniform in its range
+/// Every @checkStride-th result of each batch is checked against std::lower_bound on the shared
+/// haystack, after the completion time is taken
+/// @param latencies - [out] submit to completion time of each batch
+static int runClient(
+	LookupSegment &segment,
+	int clientIndex,
+	int64_t batchCount,
+	int batchSize,
+	int inFlight,
+	int checkStride,
+	uint64_t *latencies,
+	ClientStats &stats) {
+	const int64_t slot = segment.claimSlot();
+	if (slot == -1) {
+		printf("Client %d: no free slot\n", clientIndex);
+		return -1;
+	}
+
+	const int *hayStack = segment.haystack();
+	const int64_t haystackCount = segment.header->haystackCount;
+	std::mt19937 rng(clientIndex + 1);
+	std::uniform_int_distribution<int64_t> pickDist(0, haystackCount - 1);
+	std::uniform_int_distribution<int> valueDist(hayStack[0], hayStack[haystackCount - 1]);
+
+	uint32_t freeBuffers[LOOKUP_RING_ENTRIES];
+	uint64_t submitTime[LOOKUP_RING_ENTRIES];
+	int freeCount = 0;
+	for (int b = 0; b < inFlight; b++) {
+		freeBuffers[freeCount++] = uint32_t(b);
+	}
+
+	LookupSlot &current = segment.slot(slot);
+	int64_t submitted = 0;
+	int64_t completed = 0;
+	while (completed < batchCount) {
+		while (freeCount > 0 && submitted < batchCount) {
+			const uint32_t buffer = freeBuffers[--freeCount];
+			int *needles = segment.needles(slot, buffer);
+			for (int c = 0; c < batchSize; c++) {
+				needles[c] = (c & 1) ? valueDist(rng) : hayStack[pickDist(rng)];
+			}
+
+			submitTime[buffer] = timer_nsec();
+			current.requests.push({buffer, uint32_t(batchSize)});
+			++submitted;
+		}
+
+		LookupEntry entry;
+		bool anyCompleted = false;
+		while (current.completions.pop(entry)) {
+			const uint64_t now = timer_nsec();
+			latencies[completed++] = now - submitTime[entry.buffer];
+			anyCompleted = true;
+
+			const int *needles = segment.needles(slot, entry.buffer);
+			const int64_t *results = segment.results(slot, entry.buffer);
+			for (int c = 0; c < batchSize; c += checkStride) {
+				const int *pos = std::lower_bound(hayStack, hayStack + haystackCount, needles[c]);
+				const int64_t expected = (pos != hayStack + haystackCount && *pos == needles[c]) ? pos - hayStack : NOT_FOUND;
+				stats.mismatches += results[c] != expected;
+			}
+
+			freeBuffers[freeCount++] = entry.buffer;
+		}
+		if (!anyCompleted) {
+			sched_yield();
+		}
+	}
+
+	stats.completed = completed;
+	segment.releaseSlot(slot);
+	return 0;
+}
+
+/// Load generator for lookup-server, forks @clients processes that each submit needle batches
+/// usage: lookup-client [clients=4] [batches=10000] [batchSize=256] [inFlight=4] [stopServer=0] [checkStride=1]
+/// Prints end to end latency percentiles of the batches and the total throughput
+/// checkStride 1 checks every result, bigger strides check a sample of each batch
+int main(int argc, char *argv[]) {
+	const int clientCount = argc > 1 ? std::max(1, atoi(argv[1])) : 4;
+	const int64_t batchCount = argc > 2 ? std::max(1ll, atoll(argv[2])) : 10000;
+	const int batchSize = argc > 3 ? std::max(1, atoi(argv[3])) : 256;
+	const int inFlight = argc > 4 ? std::clamp(atoi(argv[4]), 1, LOOKUP_RING_ENTRIES) : 4;
+	const bool stopServer = argc > 5 && atoi(argv[5]) != 0;
+	const int checkStride = argc > 6 ? std::max(1, atoi(argv[6])) : 1;
+
+	LookupSegment segment;
+	if (!segment.open()) {
+		printf("Failed to open %s, is lookup-server running?\n", LOOKUP_SEGMENT_NAME);
+		return -1;
+	}
+	while (!segment.header->ready.load()) {
+		sched_yield();
+	}
+	if (batchSize > segment.header->batchCapacity || clientCount > segment.header->slotCount) {
+		printf("Server takes at most %lld clients with %lld needles per batch\n",
+			(long long)segment.header->slotCount,
+			(long long)segment.header->batchCapacity);
+		return -1;
+	}
+
+	// shared with the children so the parent can compute percentiles over all batches
+	const int64_t latencyCount = clientCount * batchCount;
+	const size_t sharedBytes = latencyCount * sizeof(uint64_t) + clientCount * sizeof(ClientStats);
+	void *shared = mmap(nullptr, sharedBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		printf("Failed to map %lld bytes for latencies\n", (long long)sharedBytes);
+		return -1;
+	}
+	uint64_t *latencies = static_cast<uint64_t *>(shared);
+	ClientStats *stats = reinterpret_cast<ClientStats *>(latencies + latencyCount);
+	memset(stats, 0, clientCount * sizeof(ClientStats));
+
+	const uint64_t t0 = timer_nsec();
+	for (int c = 0; c < clientCount; c++) {
+		const pid_t pid = fork();
+		if (pid == 0) {
+			_exit(runClient(segment, c, batchCount, batchSize, inFlight, checkStride, latencies + c * batchCount, stats[c]) ? 1 : 0);
+		}
+		if (pid < 0) {
+			printf("fork failed\n");
+			return -1;
+		}
+	}
+
+	bool failedClients = false;
+	for (int c = 0; c < clientCount; c++) {
+		int status = 0;
+		wait(&status);
+		failedClients |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+	}
+	const uint64_t t1 = timer_nsec();
+
+	if (stopServer) {
+		segment.header->shutdown.store(1);
+	}
+
+	int64_t completed = 0;
+	int64_t mismatches = 0;
+	// pack the latencies of all clients together, clients that failed completed fewer batches
+	for (int c = 0; c < clientCount; c++) {
+		std::copy(latencies + c * batchCount, latencies + c * batchCount + stats[c].completed, latencies + completed);
+		completed += stats[c].completed;
+		mismatches += stats[c].mismatches;
+	}
+	std::sort(latencies, latencies + completed);
+
+	const auto percentile = [&](double p) {
+		return completed ? double(latencies[std::min<int64_t>(completed - 1, int64_t(p * completed))]) * 1e-3 : 0.0;
+	};
+	const double seconds = double(t1 - t0) * 1e-9;
+	printf("%d clients, %lld batches of %d needles, %d in flight\n", clientCount, (long long)completed, batchSize, inFlight);
+	printf("Latency us: p50 %f p99 %f p999 %f max %f\n", percentile(0.5), percentile(0.99), percentile(0.999), percentile(1.0));
+	printf("Throughput: %f batches/s, %f Mneedles/s\n", completed / seconds, completed * batchSize / seconds * 1e-6);
+	printf("Checked every %d results: %lld mismatches\n", checkStride, (long long)mismatches);
+
+	munmap(shared, sharedBytes);
+	return failedClients || mismatches ? -1 : 0;
+}
@@ -0,0 +1,158 @@
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+
+#include <sched.h>
+
+#include "utils.hpp"
+#include "solution-picker.hpp"
+#include "lookup-service.hpp"
+
+
+/// Empty polling rounds over all slots before the server starts yielding the CPU
+const int SPIN_ROUNDS = 1 << 12;
+/// Polling rounds between checks for slots of clients that died without releasing them
+const int64_t RECLAIM_ROUNDS = 1 << 14;
+
+static LookupHeader *serverHeader = nullptr;
+
+static void onSignal(int) {
+	if (serverHeader) {
+		serverHeader->shutdown.store(1);
+	}
+}
+
+/// Own a haystack in shared memory and answer needle batches from lookup-client processes
+/// The solution can be one of allSolutions or indexedSolutions, an index is built once at start
+/// usage: lookup-server <file.bsearch> [solution=avx256] [slots=64] [batchCapacity=4096]
+/// Runs until SIGINT/SIGTERM or until a client sets the shutdown flag
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		printf("usage: %s <file.bsearch> [solution=avx256] [slots=64] [batchCapacity=4096]\n", argv[0]);
+		return -1;
+	}
+	const char *solutionName = argc > 2 ? argv[2] : "avx256";
+	const int64_t slotCount = argc > 3 ? std::max(1, atoi(argv[3])) : 64;
+	const int64_t batchCapacity = argc > 4 ? std::max(8, atoi(argv[4])) : 4096;
+
+	const SolutionInfo *solution = nullptr;
+	for (const SolutionInfo &info : allSolutions) {
+		if (!strcmp(info.name, solutionName)) {
+			solution = &info;
+		}
+	}
+	const IndexedSolutionInfo *indexedSolution = nullptr;
+	for (const IndexedSolutionInfo &info : indexedSolutions) {
+		if (!strcmp(info.name, solutionName)) {
+			indexedSolution = &info;
+		}
+	}
+	if (!solution && !indexedSolution) {
+		printf("Unknown solution %s\n", solutionName);
+		return -1;
+	}
+
+	LookupSegment segment;
+	{
+		AlignedIntArray fileHayStack;
+		AlignedIntArray fileNeedles;
+		if (!loadFromFile(fileHayStack, fileNeedles, argv[1])) {
+			printf("Failed to load %s\n", argv[1]);
+			return -1;
+		}
+		if (!segment.create(fileHayStack.getCount(), slotCount, batchCapacity)) {
+			printf("Failed to create shared memory segment %s\n", LOOKUP_SEGMENT_NAME);
+			return -1;
+		}
+		memcpy(segment.haystack(), fileHayStack.get(), fileHayStack.getCount() * sizeof(int));
+	}
+
+	serverHeader = segment.header;
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+
+	AlignedIntArray hayStack;
+	hayStack.view(segment.haystack(), segment.header->haystackCount);
+	AlignedIntArray needles;
+	AlignedIndexArray indices;
+
+	ArenaAllocator &allocator = threadArena();
+	allocator.reserve(ARENA_RESERVE_BYTES);
+
+	std::optional<BuiltIndex> index;
+	if (indexedSolution) {
+		const uint64_t buildStart = timer_nsec();
+		index.emplace(*indexedSolution, hayStack);
+		printf("Built %s in %f ms, %lld bytes\n",
+			indexedSolution->name,
+			double(timer_nsec() - buildStart) * 1e-6,
+			(long long)index->memoryBytes());
+	}
+
+	segment.header->ready.store(1);
+	printf("Serving %lld values with %s on %s, %lld slots of %d x %lld needles\n",
+		(long long)hayStack.getCount(),
+		solutionName,
+		LOOKUP_SEGMENT_NAME,
+		(long long)slotCount,
+		LOOKUP_RING_ENTRIES,
+		(long long)batchCapacity);
+	fflush(stdout);
+
+	int64_t batchesServed = 0;
+	int64_t needlesServed = 0;
+	int idleRounds = 0;
+	for (int64_t round = 1; !segment.header->shutdown.load(std::memory_order_relaxed); round++) {
+		if (round % RECLAIM_ROUNDS == 0) {
+			const int64_t reclaimed = segment.reclaimDeadSlots();
+			if (reclaimed) {
+				printf("Reclaimed %lld slots of exited clients\n", (long long)reclaimed);
+				fflush(stdout);
+			}
+		}
+
+		bool anyWork = false;
+		for (int64_t s = 0; s < slotCount; s++) {
+			LookupSlot &slot = segment.slot(s);
+			if (slot.owner.load(std::memory_order_acquire) == 0) {
+				continue;
+			}
+
+			// one batch per slot per round, so a client that keeps its ring full can't starve the rest
+			LookupEntry entry;
+			if (slot.requests.pop(entry)) {
+				// never touch memory outside the slot, even if the client sends a bad entry
+				const int64_t count = std::min<int64_t>(entry.count, batchCapacity);
+				if (entry.buffer < LOOKUP_RING_ENTRIES && count > 0) {
+					needles.view(segment.needles(s, entry.buffer), count);
+					indices.view(segment.results(s, entry.buffer), count);
+					if (index) {
+						index->search(needles, indices, allocator);
+					} else {
+						solution->search(hayStack, needles, indices, allocator);
+					}
+					needlesServed += count;
+				}
+				++batchesServed;
+
+				// a slot has as many buffers as completion entries, so this only waits on a bad client
+				while (!slot.completions.push(entry)) {
+					sched_yield();
+				}
+				anyWork = true;
+			}
+		}
+
+		if (anyWork) {
+			idleRounds = 0;
+		} else if (++idleRounds > SPIN_ROUNDS) {
+			sched_yield();
+		}
+	}
+
+	LookupSegment::unlink();
+	printf("Served %lld batches, %lld needles\n", (long long)batchesServed, (long long)needlesServed);
+	return 0;
+}
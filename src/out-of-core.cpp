@@ -0,0 +1,84 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "utils.hpp"
+#include "solutions/out-of-core.hpp"
+
+/// Search the needles of a .bsearch file without loading its haystack in memory
+/// usage: out-of-core <file.bsearch> [cacheMB=64] [queueDepth=64] [batchSize=65536] [verify=0]
+/// When verify is 1 the whole file is also loaded in memory to check the results
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		printf("usage: %s <file.bsearch> [cacheMB=64] [queueDepth=64] [batchSize=65536] [verify=0]\n", argv[0]);
+		return -1;
+	}
+
+	OutOfCoreHayStack::Config config;
+	if (argc > 2) {
+		config.cacheBytes = std::max(1ll, atoll(argv[2])) << 20;
+	}
+	if (argc > 3) {
+		config.queueDepth = std::max(1, atoi(argv[3]));
+	}
+	if (argc > 4) {
+		config.batchSize = std::max(1, atoi(argv[4]));
+	}
+	const bool checkResults = argc > 5 && atoi(argv[5]) != 0;
+
+	OutOfCoreHayStack hayStack;
+	const uint64_t openStart = timer_nsec();
+	if (!hayStack.open(argv[1], config)) {
+		printf("Failed to open %s\n", argv[1]);
+		return -1;
+	}
+	const uint64_t openEnd = timer_nsec();
+
+	AlignedIntArray needles;
+	if (!hayStack.loadNeedles(needles)) {
+		printf("Failed to read needles from %s\n", argv[1]);
+		return -1;
+	}
+
+	printf("%s: %lld values in %lld pages, %lld needles, %s reads, %lld bytes in memory\n",
+		argv[1],
+		(long long)hayStack.haystackCount,
+		(long long)hayStack.pageCount,
+		(long long)hayStack.needlesCount,
+		hayStack.backend(),
+		(long long)hayStack.memoryBytes());
+	printf("Directory build %f ms\n", double(openEnd - openStart) * 1e-6);
+
+	AlignedIndexArray indices(needles.getCount());
+	indices.memset(NOT_SEARCHED);
+
+	const uint64_t searchStart = timer_nsec();
+	if (!hayStack.search(needles, indices)) {
+		printf("Page read failed\n");
+		return -1;
+	}
+	const uint64_t searchEnd = timer_nsec();
+
+	const double searchNs = double(searchEnd - searchStart);
+	printf("Search %f ms, %f ns per needle, %lld page reads, %lld cache hits\n",
+		searchNs * 1e-6,
+		searchNs / std::max<int64_t>(1, needles.getCount()),
+		(long long)hayStack.pageReads,
+		(long long)hayStack.cacheHits);
+
+	if (checkResults) {
+		AlignedIntArray memoryHayStack;
+		AlignedIntArray memoryNeedles;
+		if (!loadFromFile(memoryHayStack, memoryNeedles, argv[1])) {
+			printf("Failed to load %s for verify\n", argv[1]);
+			return -1;
+		}
+		const int64_t mismatch = verify(memoryHayStack, needles, indices);
+		if (mismatch != -1) {
+			printf("Failed to verify needle %lld\n", (long long)mismatch);
+			return -1;
+		}
+		printf("Verify OK\n");
+	}
+	return 0;
+}
@@ -1,7 +1,6 @@
 #include "utils.hpp"
 #include "solution-picker.hpp"
 
-const int HEAP_SIZE = (1 << 24) + 1;
 
 bool profile(int index) {
 
@@ -17,12 +16,10 @@ bool profile(int index) {
 
 	printf("Checking %s... ", fname);
 
-	AlignedArrayPtr<int> indices(needles.getCount());
-	AlignedArrayPtr<uint8_t> heap(HEAP_SIZE);
-
-	StackAllocator allocator(heap, HEAP_SIZE);
+	AlignedIndexArray indices(needles.getCount());
+	ArenaAllocator &allocator = threadArena();
 	indices.memset(NOT_SEARCHED);
-	allocator.zeroAll();
+	allocator.reserve(ARENA_RESERVE_BYTES);
 
 	for (int c = 0; c < 10000; c++) {
 		TEST_SEARCH(hayStack, needles, indices, allocator);
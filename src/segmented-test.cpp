@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include "utils.hpp"
+#include "solution-picker.hpp"
+#include "solutions/segmented.hpp"
+
+const int TEST_REPEAT = 20;
+
+/// Segments with random sizes in [0, @maxSegmentSize] and sorted uniform values
+void initSegments(SegmentedHayStack &hayStack, int64_t segmentCount, int64_t maxSegmentSize, std::mt19937 &rng) {
+	std::uniform_int_distribution<int64_t> sizeDist(0, maxSegmentSize);
+	AlignedArrayPtr<int64_t> sizes(segmentCount);
+	int64_t totalCount = 0;
+	for (int64_t s = 0; s < segmentCount; s++) {
+		sizes[s] = sizeDist(rng);
+		totalCount += sizes[s];
+	}
+
+	hayStack.init(totalCount, segmentCount);
+	hayStack.offsets[0] = 0;
+	for (int64_t s = 0; s < segmentCount; s++) {
+		const int64_t start = hayStack.offsets[s];
+		hayStack.offsets[s + 1] = start + sizes[s];
+
+		std::uniform_int_distribution<int> dataDist(0, int(sizes[s] * 2));
+		for (int64_t c = start; c < start + sizes[s]; c++) {
+			hayStack.values[c] = dataDist(rng);
+		}
+		std::sort(hayStack.values.get() + start, hayStack.values.get() + start + sizes[s]);
+	}
+	hayStack.updateMaxSegmentSize();
+}
+
+/// Uniform segments, half of the needles are picked from their segment
+void initNeedles(const SegmentedHayStack &hayStack, AlignedIntArray &needles, AlignedIntArray &segments, std::mt19937 &rng) {
+	std::uniform_int_distribution<int> segmentDist(0, int(hayStack.segmentCount - 1));
+	for (int64_t c = 0; c < needles.getCount(); c++) {
+		const int segment = segmentDist(rng);
+		const int64_t start = hayStack.offsets[segment];
+		const int64_t size = hayStack.offsets[segment + 1] - start;
+		segments[c] = segment;
+		if ((c & 1) && size > 0) {
+			needles[c] = hayStack.values[start + std::uniform_int_distribution<int64_t>(0, size - 1)(rng)];
+		} else {
+			needles[c] = std::uniform_int_distribution<int>(0, int(size * 2))(rng);
+		}
+	}
+}
+
+/// Check @indices against std::lower_bound in the segment of each needle
+int64_t verifySegmented(const SegmentedHayStack &hayStack, const AlignedIntArray &needles, const AlignedIntArray &segments, const AlignedIndexArray &indices) {
+	const int *values = hayStack.values.get();
+	for (int64_t c = 0; c < needles.getCount(); c++) {
+		const int64_t start = hayStack.offsets[segments[c]];
+		const int64_t end = hayStack.offsets[segments[c] + 1];
+		const int *pos = std::lower_bound(values + start, values + end, needles[c]);
+		const int64_t expected = pos != values + end && *pos == needles[c] ? pos - values - start : NOT_FOUND;
+		if (indices[c] != expected) {
+			return c;
+		}
+	}
+	return -1;
+}
+
+/// The alternative to the segmented API: group the needles by segment and call a solution per segment
+void perSegmentSearch(
+	SearchFunction search,
+	const SegmentedHayStack &hayStack,
+	const AlignedIntArray &needles,
+	const AlignedIntArray &segments,
+	AlignedIndexArray &indices,
+	ArenaAllocator &allocator) {
+	const int64_t segmentCount = hayStack.segmentCount;
+	const int64_t needlesCount = needles.getCount();
+
+	// counting sort of the needles by segment
+	AlignedArrayPtr<int64_t> segmentStart(segmentCount + 1);
+	segmentStart.memset(0);
+	for (int64_t c = 0; c < needlesCount; c++) {
+		++segmentStart[segments[c] + 1];
+	}
+	for (int64_t s = 0; s < segmentCount; s++) {
+		segmentStart[s + 1] += segmentStart[s];
+	}
+	AlignedIntArray groupedNeedles(needlesCount);
+	AlignedArrayPtr<int64_t> needleIndex(needlesCount);
+	AlignedIndexArray groupedIndices(needlesCount);
+	AlignedArrayPtr<int64_t> position(segmentCount);
+	for (int64_t s = 0; s < segmentCount; s++) {
+		position[s] = segmentStart[s];
+	}
+	for (int64_t c = 0; c < needlesCount; c++) {
+		const int64_t p = position[segments[c]]++;
+		groupedNeedles[p] = needles[c];
+		needleIndex[p] = c;
+	}
+
+	AlignedIntArray segmentHayStack;
+	AlignedIntArray segmentNeedles;
+	AlignedIndexArray segmentIndices;
+	for (int64_t s = 0; s < segmentCount; s++) {
+		const int64_t count = segmentStart[s + 1] - segmentStart[s];
+		const int64_t size = hayStack.offsets[s + 1] - hayStack.offsets[s];
+		if (count == 0) {
+			continue;
+		}
+		if (size == 0) {
+			for (int64_t p = segmentStart[s]; p < segmentStart[s + 1]; p++) {
+				groupedIndices[p] = NOT_FOUND;
+			}
+			continue;
+		}
+		segmentHayStack.view(const_cast<int *>(hayStack.values.get()) + hayStack.offsets[s], size);
+		segmentNeedles.view(groupedNeedles.get() + segmentStart[s], count);
+		segmentIndices.view(groupedIndices.get() + segmentStart[s], count);
+		search(segmentHayStack, segmentNeedles, segmentIndices, allocator);
+	}
+
+	for (int64_t p = 0; p < needlesCount; p++) {
+		indices[needleIndex[p]] = groupedIndices[p];
+	}
+}
+
+/// Compare the segmented kernels with one solution call per segment
+/// usage: segmented-test [segments=10000] [maxSegmentSize=4096] [needles=1048576]
+int main(int argc, char *argv[]) {
+	const int64_t segmentCount = argc > 1 ? std::max(1ll, atoll(argv[1])) : 10000;
+	const int64_t maxSegmentSize = argc > 2 ? std::max(1ll, atoll(argv[2])) : 4096;
+	const int64_t needlesCount = argc > 3 ? std::max(1ll, atoll(argv[3])) : 1 << 20;
+
+	std::mt19937 rng(42);
+	SegmentedHayStack hayStack;
+	initSegments(hayStack, segmentCount, maxSegmentSize, rng);
+	AlignedIntArray needles(needlesCount);
+	AlignedIntArray segments(needlesCount);
+	initNeedles(hayStack, needles, segments, rng);
+	AlignedIndexArray indices(needlesCount);
+
+	ArenaAllocator &allocator = threadArena();
+	allocator.reserve(ARENA_RESERVE_BYTES);
+
+	printf("%lld segments, %lld values, %lld needles\n",
+		(long long)segmentCount,
+		(long long)hayStack.values.getCount(),
+		(long long)needlesCount);
+
+	const bool passed = timeVerifiedMethods(TEST_REPEAT, needlesCount, {
+		{"perSegment binarySearch", [&] { perSegmentSearch(binarySearch, hayStack, needles, segments, indices, allocator); }},
+		{"perSegment avx256", [&] { perSegmentSearch(avx256, hayStack, needles, segments, indices, allocator); }},
+		{"segmentedBinarySearch", [&] { segmentedBinarySearch(hayStack, needles, segments, indices); }},
+		{"avx256Segmented", [&] { avx256Segmented(hayStack, needles, segments, indices, allocator); }},
+	}, indices, [&] { return verifySegmented(hayStack, needles, segments, indices); });
+	return passed ? 0 : -1;
+}
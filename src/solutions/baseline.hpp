@@ -7,15 +7,15 @@
 /// @param hayStack - the input data that will be searched in
 /// @param needles - the values that will be searched
 /// @param indices - the indices of the needles (or -1 if the needle is not found)
-static void binarySearch(const AlignedIntArray &hayStack, const AlignedIntArray &needles, AlignedIntArray &indices) {
-	for (int c = 0; c < needles.getCount(); c++) {
+static void binarySearch(const AlignedIntArray &hayStack, const AlignedIntArray &needles, AlignedIndexArray &indices) {
+	for (int64_t c = 0; c < needles.getCount(); c++) {
 		const int value = needles[c];
 
-		int left = 0;
-		int count = hayStack.getCount();
+		int64_t left = 0;
+		int64_t count = hayStack.getCount();
 
 		while (count > 0) {
-			const int half = count / 2;
+			const int64_t half = count / 2;
 
 			if (hayStack[left + half] < value) {
 				left = left + half + 1;
@@ -36,8 +36,8 @@ static void binarySearch(const AlignedIntArray &hayStack, const AlignedIntArray
 static void binarySearch(
     const AlignedIntArray &hayStack,
     const AlignedIntArray &needles,
-    AlignedIntArray &indices,
-    StackAllocator &allocator)
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
 {
 	binarySearch(hayStack, needles, indices);
 }
\ No newline at end of file
@@ -0,0 +1,267 @@
+#pragma once
+
+#include "utils.hpp"
+
+#ifndef __clang__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <cmath>
+
+namespace {
+/// Sorted haystack split in blocks of BlockSize values, each block stored as offsets from its
+/// first (smallest) value, bit-packed with the smallest width that fits the block
+/// Blocks that need more than MaxPackedWidth bits are stored raw
+struct CompressedHayStack {
+    static const int BlockSize = 128;
+    static const int GroupSize = 8;
+    static const int MaxPackedWidth = 25;
+    static const int RawWidth = 32;
+
+    /// Build from sorted @hayStack, can be called again to rebuild
+    void init(const AlignedIntArray &hayStack)
+    {
+        count = hayStack.getCount();
+        blockCount = (count + BlockSize - 1) / BlockSize;
+        lastValue = hayStack[count - 1];
+
+        mins.init(blockCount);
+        offsets.init(blockCount);
+        widths.init(blockCount);
+
+        int64_t dataBytes = 0;
+        for (int64_t b = 0; b < blockCount; b++) {
+            const int64_t start = b * BlockSize;
+            const int64_t end = std::min(start + BlockSize, count);
+            const uint32_t range = uint32_t(hayStack[end - 1]) - uint32_t(hayStack[start]);
+            const int bits = range == 0 ? 0 : 32 - std::countl_zero(range);
+
+            mins[b] = hayStack[start];
+            widths[b] = bits > MaxPackedWidth ? RawWidth : bits;
+            offsets[b] = dataBytes;
+            dataBytes += BlockSize * widths[b] / 8;
+        }
+
+        // decoding loads up to 32 bytes past the start of the last group
+        data.init(dataBytes + 32);
+        data.memset(0);
+
+        for (int64_t b = 0; b < blockCount; b++) {
+            const int64_t start = b * BlockSize;
+            const int64_t end = std::min(start + BlockSize, count);
+            uint8_t *block = data + offsets[b];
+            const int width = widths[b];
+
+            // the last block is padded with its max value so searches never stop on the padding
+            for (int c = 0; c < BlockSize; c++) {
+                const int value = hayStack[std::min(start + c, end - 1)];
+                if (width == RawWidth) {
+                    memcpy(block + c * sizeof(int), &value, sizeof(int));
+                    continue;
+                }
+
+                const uint64_t packed = uint64_t(uint32_t(value) - uint32_t(mins[b]));
+                const int bit = c * width;
+                uint64_t word;
+                memcpy(&word, block + bit / 8, sizeof(word));
+                word |= packed << (bit % 8);
+                memcpy(block + bit / 8, &word, sizeof(word));
+            }
+        }
+    }
+
+    /// Total bytes used by the compressed representation, including the directory
+    int64_t memoryBytes() const
+    {
+        return data.getCount() + blockCount * (sizeof(int) + sizeof(int64_t) + sizeof(uint8_t));
+    }
+
+    /// Find the position of the first value not less than @value inside @block
+    /// @param equal [out] - set to true if the value at the returned position is @value
+    /// @return position in the block or BlockSize if all values in the block are less
+    int lowerBoundInBlock(int64_t block, int value, bool &equal) const
+    {
+        const int width = widths[block];
+        const uint8_t *blockPtr = data + offsets[block];
+
+        __m256i needle;
+        if (width == RawWidth) {
+            needle = _mm256_set1_epi32(value);
+        } else {
+            // packed offsets are below 2^MaxPackedWidth so clamping does not change the result
+            const int64_t relative = int64_t(value) - mins[block];
+            needle = _mm256_set1_epi32(int(std::min<int64_t>(relative, INT_MAX)));
+        }
+
+        for (int g = 0; g < BlockSize / GroupSize; g++) {
+            const __m256i values = decodeGroup(blockPtr, width, g);
+            const __m256i lt = _mm256_cmpgt_epi32(needle, values);
+            const int ltMask = _mm256_movemask_ps(_mm256_castsi256_ps(lt));
+            if (ltMask != 0xFF) {
+                const int lane = std::countr_zero(unsigned(~ltMask));
+                const __m256i eq = _mm256_cmpeq_epi32(needle, values);
+                const int eqMask = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+                equal = (eqMask >> lane) & 1;
+                return g * GroupSize + lane;
+            }
+        }
+        equal = false;
+        return BlockSize;
+    }
+
+    /// Decode the GroupSize values of group @group in a block with @width bits per value
+    static __m256i decodeGroup(const uint8_t *blockPtr, int width, int group)
+    {
+        if (width == RawWidth) {
+            return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(blockPtr) + group);
+        }
+
+        // GroupSize values take exactly @width bytes, so every group starts on a byte
+        // the high 4 values are loaded from the byte where the 5th value starts
+        const DecodeTable &table = decodeTables()[width];
+        const uint8_t *groupPtr = blockPtr + group * width;
+        const __m256i bytes = _mm256_loadu2_m128i(
+            reinterpret_cast<const __m128i *>(groupPtr + table.highByte),
+            reinterpret_cast<const __m128i *>(groupPtr));
+        const __m256i shuffled = _mm256_shuffle_epi8(bytes, table.shuffle);
+        const __m256i shifted = _mm256_srlv_epi32(shuffled, table.shift);
+        return _mm256_and_si256(shifted, table.mask);
+    }
+
+    int64_t count = 0;
+    int64_t blockCount = 0;
+    int lastValue = 0;
+    /// First value of each block, the top level directory
+    AlignedIntArray mins;
+    /// Byte offset of each block in @data and its bits per value
+    AlignedArrayPtr<int64_t> offsets;
+    AlignedArrayPtr<uint8_t> widths;
+    AlignedArrayPtr<uint8_t> data;
+
+private:
+    struct DecodeTable {
+        __m256i shuffle;
+        __m256i shift;
+        __m256i mask;
+        int highByte;
+    };
+
+    /// Shuffle and shift constants that move each packed value to its own 32 bit lane
+    static const DecodeTable *decodeTables()
+    {
+        static const struct Tables {
+            DecodeTable tables[MaxPackedWidth + 1];
+            Tables()
+            {
+                for (int width = 0; width <= MaxPackedWidth; width++) {
+                    alignas(32) uint8_t shuffle[32];
+                    alignas(32) int shift[8];
+                    const int highByte = 4 * width / 8;
+                    for (int lane = 0; lane < GroupSize; lane++) {
+                        const int bit = lane * width - (lane < 4 ? 0 : highByte * 8);
+                        for (int b = 0; b < 4; b++) {
+                            shuffle[lane * 4 + b] = uint8_t(bit / 8 + b);
+                        }
+                        shift[lane] = bit % 8;
+                    }
+                    tables[width].shuffle =
+                        _mm256_load_si256(reinterpret_cast<const __m256i *>(shuffle));
+                    tables[width].shift =
+                        _mm256_load_si256(reinterpret_cast<const __m256i *>(shift));
+                    tables[width].mask = _mm256_set1_epi32(int((1ull << width) - 1));
+                    tables[width].highByte = highByte;
+                }
+            }
+        } decode;
+        return decode.tables;
+    }
+};
+
+/// Search in a block compressed copy of the haystack, built once by init
+/// The block is found with a binary search over the block minimums, with the top levels in a bin
+/// as in eytzingerSearch, then only that block is decoded and searched with AVX2
+/// Searches read only the compressed copy and the bin, the haystack is not kept
+template <int BinStepCount>
+struct BlockCompressedSearch {
+    CompressedHayStack compressed;
+    /// Top levels of the search over the block minimums, element 0 is unused
+    AlignedIntArray bin;
+    int stepCount = 0;
+
+    void init(const AlignedIntArray &hayStack)
+    {
+        compressed.init(hayStack);
+        // deeper levels would contain empty sub-ranges
+        stepCount = std::min(BinStepCount, int(log2(compressed.blockCount + 1)));
+        bin.init((1 << stepCount) + 1);
+        precomputeBin(compressed.mins, compressed.blockCount, bin, stepCount);
+    }
+
+    /// Bytes of the compressed copy, its directory and the bin
+    int64_t memoryBytes() const
+    {
+        return compressed.memoryBytes() + bin.getCount() * int64_t(sizeof(int));
+    }
+
+    void search(
+        const AlignedIntArray &needles, AlignedIndexArray &indices, ArenaAllocator &) const
+    {
+        const int64_t blockCount = compressed.blockCount;
+        const int *mins = compressed.mins;
+
+        for (int64_t c = 0; c < needles.count; c++) {
+            const int value = needles[c];
+
+            if (value < mins[0] || value > compressed.lastValue) {
+                indices[c] = NOT_FOUND;
+                continue;
+            }
+
+            // count the blocks with minimum less than value
+            int64_t left = 0;
+            int64_t count = blockCount;
+            int binIdx = 1;
+            int step = 0;
+
+            while (count > 0) {
+                const int64_t half = count / 2;
+
+                const int testValue = step < stepCount ? bin[binIdx] : mins[left + half];
+                ++step;
+
+                if (testValue < value) {
+                    left = left + half + 1;
+                    count -= half + 1;
+                    binIdx = binIdx * 2 + 1;
+                } else {
+                    count = half;
+                    binIdx = binIdx * 2;
+                }
+            }
+
+            if (left == 0) {
+                indices[c] = mins[0] == value ? 0 : NOT_FOUND;
+                continue;
+            }
+
+            const int64_t block = left - 1;
+            const int64_t blockStart = block * CompressedHayStack::BlockSize;
+            const int64_t blockLength =
+                std::min<int64_t>(CompressedHayStack::BlockSize, compressed.count - blockStart);
+
+            bool equal = false;
+            const int position = compressed.lowerBoundInBlock(block, value, equal);
+            if (position < blockLength) {
+                indices[c] = equal ? blockStart + position : NOT_FOUND;
+            } else if (block + 1 < blockCount && mins[block + 1] == value) {
+                indices[c] = blockStart + blockLength;
+            } else {
+                indices[c] = NOT_FOUND;
+            }
+        }
+    }
+};
+} // namespace
@@ -0,0 +1,348 @@
+#pragma once
+
+#include "utils.hpp"
+#include "single-lookup.hpp"
+
+#ifndef __clang__
+#include <immintrin.h>
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <vector>
+
+/// Lookups stop suspending once their range is this small
+const int64_t CoroutineMinSuspendCount = 32;
+
+namespace {
+/// Free list of coroutine frames, a lookup frame is created and destroyed for every key
+struct FramePool {
+    static const size_t FrameBytes = 256;
+    void *freeList = nullptr;
+
+    void *alloc(size_t size)
+    {
+        if (size > FrameBytes) {
+            return ::operator new(size);
+        }
+        if (!freeList) {
+            return ::operator new(FrameBytes);
+        }
+        void *frame = freeList;
+        freeList = *static_cast<void **>(frame);
+        return frame;
+    }
+
+    void release(void *frame, size_t size)
+    {
+        if (size > FrameBytes) {
+            return ::operator delete(frame);
+        }
+        *static_cast<void **>(frame) = freeList;
+        freeList = frame;
+    }
+
+    ~FramePool()
+    {
+        while (freeList) {
+            void *next = *static_cast<void **>(freeList);
+            ::operator delete(freeList);
+            freeList = next;
+        }
+    }
+};
+
+thread_local FramePool framePool;
+
+/// Frames of all lookup coroutines come from framePool
+struct PooledPromise {
+    static void *operator new(size_t size)
+    {
+        return framePool.alloc(size);
+    }
+
+    static void operator delete(void *frame, size_t size)
+    {
+        framePool.release(frame, size);
+    }
+
+    std::suspend_always initial_suspend() noexcept
+    {
+        return {};
+    }
+
+    void unhandled_exception()
+    {
+        std::terminate();
+    }
+};
+
+/// Resumes suspended coroutines in the order they were scheduled
+class LookupScheduler {
+public:
+    LookupScheduler()
+        : ready(64)
+    {
+    }
+
+    void schedule(std::coroutine_handle<> handle)
+    {
+        if (tail - head == ready.size()) {
+            grow();
+        }
+        ready[tail++ & (ready.size() - 1)] = handle;
+    }
+
+    /// Resume coroutines until none is scheduled
+    void run()
+    {
+        while (head != tail) {
+            ready[head++ & (ready.size() - 1)].resume();
+        }
+    }
+
+    /// co_await scheduler.yield() lets every other scheduled coroutine run once
+    auto yield()
+    {
+        struct Yield {
+            LookupScheduler &scheduler;
+
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                scheduler.schedule(handle);
+            }
+
+            void await_resume() const noexcept {}
+        };
+        return Yield{*this};
+    }
+
+private:
+    /// Ring of handles, the size is a power of two
+    std::vector<std::coroutine_handle<>> ready;
+    size_t head = 0;
+    size_t tail = 0;
+
+    void grow()
+    {
+        std::vector<std::coroutine_handle<>> bigger(ready.size() * 2);
+        for (size_t c = 0; c < ready.size(); c++) {
+            bigger[c] = ready[(head + c) & (ready.size() - 1)];
+        }
+        tail -= head;
+        head = 0;
+        ready.swap(bigger);
+    }
+};
+
+/// Coroutine that returns a @T to the coroutine awaiting it, started by the co_await
+/// A task made by ready() has no coroutine, co_await returns its value without suspending
+template <typename T>
+class LookupTask {
+public:
+    struct promise_type : PooledPromise {
+        T value{};
+        std::coroutine_handle<> continuation;
+
+        LookupTask get_return_object()
+        {
+            return LookupTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        auto final_suspend() noexcept
+        {
+            // resume the awaiting coroutine directly, without a trip through the scheduler
+            struct FinalAwaiter {
+                bool await_ready() const noexcept
+                {
+                    return false;
+                }
+
+                std::coroutine_handle<> await_suspend(
+                    std::coroutine_handle<promise_type> handle) noexcept
+                {
+                    return handle.promise().continuation;
+                }
+
+                void await_resume() const noexcept {}
+            };
+            return FinalAwaiter{};
+        }
+
+        void return_value(T result)
+        {
+            value = result;
+        }
+    };
+
+    /// @return task with the result known, awaiting it does not suspend
+    static LookupTask ready(T result)
+    {
+        LookupTask task(nullptr);
+        task.value = result;
+        return task;
+    }
+
+    LookupTask(LookupTask &&other) noexcept
+        : handle(std::exchange(other.handle, nullptr))
+        , value(other.value)
+    {
+    }
+
+    ~LookupTask()
+    {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept
+    {
+        return !handle;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting)
+    {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    T await_resume()
+    {
+        return handle ? handle.promise().value : value;
+    }
+
+private:
+    explicit LookupTask(std::coroutine_handle<promise_type> newHandle)
+        : handle(newHandle)
+    {
+    }
+
+    std::coroutine_handle<promise_type> handle;
+    T value{};
+};
+
+/// Top level coroutine of application code, started and run to the end by a LookupScheduler
+class LookupJob {
+public:
+    struct promise_type : PooledPromise {
+        LookupJob get_return_object()
+        {
+            return LookupJob(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_void() {}
+    };
+
+    LookupJob(LookupJob &&other) noexcept
+        : handle(std::exchange(other.handle, nullptr))
+    {
+    }
+
+    ~LookupJob()
+    {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    /// Schedule the first run of the job on @scheduler
+    void start(LookupScheduler &scheduler)
+    {
+        scheduler.schedule(handle);
+    }
+
+private:
+    explicit LookupJob(std::coroutine_handle<promise_type> newHandle)
+        : handle(newHandle)
+    {
+    }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+/// Awaitable one key at a time lookups, many of them in flight on one thread
+/// The bin levels of a LatencySearch are searched without suspending, they stay in cache
+/// Each haystack probe is prefetched, then the lookup suspends and the scheduler runs the other
+/// lookups, so their cache misses overlap
+class CoroutineIndex {
+public:
+    /// The haystack is not copied and must outlive the index
+    CoroutineIndex(const AlignedIntArray &hayStack, LookupScheduler &newScheduler)
+        : scheduler(newScheduler)
+    {
+        search.init(hayStack);
+    }
+
+    /// @return in co_await, the index of the first element equal to @value or -1
+    /// Lookups that need no suspend are finished here and do not start a coroutine, a chain of
+    /// them would transfer job -> task -> job and only the tail calls of an optimized build
+    /// keep that from growing the stack
+    LookupTask<int64_t> find(int value)
+    {
+        const int *binPtr = search.bin.get();
+        int64_t left = 0;
+        int64_t count = search.haystackCount;
+        int64_t binIdx = 1;
+
+        for (int step = 0; step < search.binSteps; step++) {
+            const int64_t half = count / 2;
+            const bool less = binPtr[binIdx] < value;
+            left = less ? left + half + 1 : left;
+            count = less ? count - half - 1 : half;
+            binIdx = binIdx * 2 + less;
+        }
+
+        if (count > CoroutineMinSuspendCount) {
+            return probeHaystack(value, left, count);
+        }
+        return LookupTask<int64_t>::ready(finishSearch(value, left, count));
+    }
+
+private:
+    LatencySearch search;
+    LookupScheduler &scheduler;
+
+    /// Search [@left, @left + @count) of the haystack, suspending on each probe until the
+    /// range is CoroutineMinSuspendCount values, the first probe always suspends
+    LookupTask<int64_t> probeHaystack(int value, int64_t left, int64_t count)
+    {
+        const int *hayStack = search.hayStack;
+        while (count > CoroutineMinSuspendCount) {
+            const int64_t half = count / 2;
+            _mm_prefetch(reinterpret_cast<const char *>(hayStack + left + half), _MM_HINT_T0);
+            co_await scheduler.yield();
+
+            const bool less = hayStack[left + half] < value;
+            left = less ? left + half + 1 : left;
+            count = less ? count - half - 1 : half;
+        }
+        co_return finishSearch(value, left, count);
+    }
+
+    /// Search [@left, @left + @count) without suspending, the last probes are in the lines of
+    /// the previous ones and suspending costs more than the misses
+    int64_t finishSearch(int value, int64_t left, int64_t count) const
+    {
+        const int *hayStack = search.hayStack;
+        while (count > 0) {
+            const int64_t half = count / 2;
+            const bool less = hayStack[left + half] < value;
+            left = less ? left + half + 1 : left;
+            count = less ? count - half - 1 : half;
+        }
+        return left < search.haystackCount && hayStack[left] == value ? left : NOT_FOUND;
+    }
+};
+} // namespace
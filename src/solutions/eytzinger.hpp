@@ -1,68 +1,156 @@
 #pragma once
 
 #include "utils.hpp"
+#include "parallel.hpp"
 #include "stl.hpp"
-
+#include "search-stats.hpp"
+
+namespace {
+/// Top @BinStepCount steps of the search, read from the bin and unrolled since their number is
+/// fixed, so there is no step counter and no check for the end of the bin
+/// The haystack must have at least (1 << BinStepCount) - 1 values, no range gets empty before
+/// the last bin step
+/// @param left [in/out] - first index of the range left to search
+/// @param count [in/out] - size of the range left to search
 template <int BinStepCount>
-static void eytzingerSearch(
+__attribute__((always_inline)) inline void eytzingerBinSteps(
+    const int *bin, int value, int64_t &left, int64_t &count)
+{
+    int binIdx = 1;
+#pragma GCC unroll 32
+    for (int step = 0; step < BinStepCount; ++step) {
+        const int64_t half = count / 2;
+        if (bin[binIdx] < value) {
+            left = left + half + 1;
+            count -= half + 1;
+            binIdx = binIdx * 2 + 1;
+        } else {
+            count = half;
+            binIdx = binIdx * 2;
+        }
+    }
+}
+} // namespace
+
+/// eytzingerSearch with a bin built by the caller
+/// @param bin - top BinStepCount levels of the search as built by precomputeBin, 1 based, the
+/// haystack has at least (1 << BinStepCount) - 1 values
+/// @tparam Stats - NoStats or SearchStats to count the steps in the bin and in the haystack
+template <int BinStepCount, typename Stats = NoStats>
+static void eytzingerSearchBin(
     const AlignedIntArray &hayStack,
     const AlignedIntArray &needles,
-    AlignedIntArray &indices,
-    StackAllocator &allocator)
+    AlignedIndexArray &indices,
+    const int *bin)
 {
-	const int stepCount = BinStepCount;
-	int *allocBin = allocator.alloc<int>((1 << stepCount) - 1);
-	int *bin = allocBin - 1;
-	precomputeBin(hayStack, hayStack.count, bin, stepCount);
-
-	for (int c = 0; c < needles.count; c++) {
+	for (int64_t c = 0; c < needles.count; c++) {
 		const int value = needles[c];
 
-		int left = 0;
-		int count = hayStack.count;
-		int binIdx = 1;
-		int step = 0;
+		int64_t left = 0;
+		int64_t count = hayStack.count;
+		eytzingerBinSteps<BinStepCount>(bin, value, left, count);
 
+		int haystackSteps = 0;
 		while (count > 0) {
-			const int half = count / 2;
+			const int64_t half = count / 2;
+			++haystackSteps;
 
-			const int testValue = step < stepCount ? bin[binIdx] : hayStack[left + half];
-			++step;
-
-			if (testValue < value) {
+			if (hayStack[left + half] < value) {
 				left = left + half + 1;
 				count -= half + 1;
-				binIdx = binIdx * 2 + 1;
 			} else {
 				count = half;
-				binIdx = binIdx * 2;
 			}
 		}
+		Stats::serialNeedles(1);
+		Stats::steps(BinStepCount, haystackSteps, 1);
 
-		if (hayStack[left] == value) {
+		if (left < hayStack.count && hayStack[left] == value) {
 			indices[c] = left;
 		} else {
 			indices[c] = -1;
 		}
 	}
+}
+
+/// Binary search whose top @BinStepCount steps read a bin of their test values, built per call
+/// on the calling thread, EytzingerSearch builds it once
+/// @tparam Stats - NoStats or SearchStats to count the steps in the bin and in the haystack
+template <int BinStepCount, typename Stats = NoStats>
+static void eytzingerSearch(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
+{
+	// the bin would hold most of a smaller haystack and leave empty ranges in its last levels
+	if (hayStack.count < (1 << BinStepCount) - 1) {
+		Stats::shortcutNeedles(needles.count);
+		return stlLowerBound(hayStack, needles, indices, allocator);
+	}
+	const int stepCount = BinStepCount;
+	const ArenaAllocator::Scope scope(allocator);
+	int *allocBin = allocator.alloc<int>((1 << stepCount) - 1);
+	int *bin = allocBin - 1;
+	precomputeBin(hayStack, hayStack.count, bin, stepCount);
 
-	allocator.freeAll();
+	eytzingerSearchBin<BinStepCount, Stats>(hayStack, needles, indices, bin);
 }
 
+namespace {
+/// eytzingerSearch with the bin built once by init, split across threads with
+/// parallelPrecomputeBin
+/// The haystack is not copied and must outlive the index
+template <int BinStepCount>
+struct EytzingerSearch {
+    const AlignedIntArray *hayStack = nullptr;
+    /// Top levels of the search, element 0 is unused
+    AlignedIntArray bin;
+    /// False for haystacks smaller than the bin, they are searched with stlLowerBound
+    bool hasBin = false;
+
+    void init(const AlignedIntArray &newHayStack)
+    {
+        hayStack = &newHayStack;
+        hasBin = hayStack->getCount() >= (1 << BinStepCount) - 1;
+        if (hasBin) {
+            bin.init(1 << BinStepCount);
+            parallelPrecomputeBin(hayStack->get(), hayStack->getCount(), bin, BinStepCount);
+        }
+    }
+
+    /// Bytes of the bin, without the haystack
+    int64_t memoryBytes() const
+    {
+        return hasBin ? bin.getCount() * int64_t(sizeof(int)) : 0;
+    }
+
+    void search(
+        const AlignedIntArray &needles, AlignedIndexArray &indices, ArenaAllocator &allocator) const
+    {
+        if (!hasBin) {
+            return stlLowerBound(*hayStack, needles, indices, allocator);
+        }
+        eytzingerSearchBin<BinStepCount>(*hayStack, needles, indices, bin);
+    }
+};
+} // namespace
+
 template <int BinStepCount>
-static void eytzingerSearchRangeCheck(const AlignedIntArray &hayStack, const AlignedIntArray &needles, AlignedIntArray &indices, StackAllocator &allocator) {
-    if (needles.getCount() <= 1024) {
+static void eytzingerSearchRangeCheck(const AlignedIntArray &hayStack, const AlignedIntArray &needles, AlignedIndexArray &indices, ArenaAllocator &allocator) {
+    if (needles.getCount() <= 1024 || hayStack.getCount() < (1 << BinStepCount) - 1) {
         return stlLowerBound(hayStack, needles, indices, allocator);
     }
 	const int stepCount = BinStepCount;
+	const ArenaAllocator::Scope scope(allocator);
 	int *allocBin = allocator.alloc<int>((1 << stepCount) - 1);
 	int *bin = allocBin - 1;
 	precomputeBin(hayStack, hayStack.count, bin, stepCount);
 
 	const int low = hayStack[0];
-	const int high = hayStack[int(hayStack.getCount() - 1)];
+	const int high = hayStack[hayStack.getCount() - 1];
 
-	for (int c = 0; c < needles.count; c++) {
+	for (int64_t c = 0; c < needles.count; c++) {
 		const int value = needles[c];
 
 		if (value < low || value > high) {
@@ -70,24 +158,18 @@ static void eytzingerSearchRangeCheck(const AlignedIntArray &hayStack, const Ali
 			continue;
 		}
 
-		int left = 0;
-		int count = hayStack.count;
-		int binIdx = 1;
-		int step = 0;
+		int64_t left = 0;
+		int64_t count = hayStack.count;
+		eytzingerBinSteps<BinStepCount>(bin, value, left, count);
 
 		while (count > 0) {
-			const int half = count / 2;
+			const int64_t half = count / 2;
 
-			const int testValue = step < stepCount ? bin[binIdx] : hayStack[left + half];
-			++step;
-
-			if (testValue < value) {
+			if (hayStack[left + half] < value) {
 				left = left + half + 1;
 				count -= half + 1;
-				binIdx = binIdx * 2 + 1;
 			} else {
 				count = half;
-				binIdx = binIdx * 2;
 			}
 		}
 
@@ -97,6 +179,4 @@ static void eytzingerSearchRangeCheck(const AlignedIntArray &hayStack, const Ali
 			indices[c] = -1;
 		}
 	}
-
-	allocator.freeAll();
 }
\ No newline at end of file
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "utils.hpp"
+#include "key-bucket.hpp"
+
+#ifndef __clang__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <climits>
+
+/// Most keys per bucket on average, 6 of 8 slots so nearly all lookups end in their first bucket
+const int HashBucketLoad = 6;
+/// Needles between hashing a needle and probing its bucket, hides the miss on the bucket
+const int64_t HashPrefetchDistance = 16;
+/// Key of the empty slots, a needle equal to it is answered by HashIndex::minPosition
+const int HashEmptyKey = INT_MIN;
+
+namespace {
+/// Exact match index that does not use the order of the haystack: an open addressing table
+/// from each distinct value to its first index, with buckets of 8 slots and linear probing
+/// between buckets, a probe that ends in its first bucket reads one cache line
+/// The bucket count is not rounded to a power of two, the high 32 bits of hash * bucketCount
+/// pick the bucket, so the table is about 64 / HashBucketLoad bytes per distinct value
+/// A lookup hashes the needle, compares it to the 8 keys of its bucket and stops at the first
+/// bucket with an empty slot, the key compare is the verification so there are no false hits
+/// Positions are 32 bit, bigger haystacks are not indexed and init returns false
+struct HashIndex {
+    AlignedArrayPtr<KeyBucket> buckets;
+    int64_t bucketCount = 0;
+    int64_t keyCount = 0;
+    /// Answer for needles equal to HashEmptyKey, which is never stored in a slot
+    int64_t minPosition = NOT_FOUND;
+
+    bool init(const AlignedIntArray &hayStack)
+    {
+        const int64_t haystackCount = hayStack.getCount();
+        if (haystackCount > INT_MAX) {
+            return false;
+        }
+
+        int64_t distinct = 0;
+        for (int64_t c = 0; c < haystackCount; c++) {
+            distinct += c == 0 || hayStack[c] != hayStack[c - 1];
+        }
+        bucketCount = std::max<int64_t>(1, (distinct + HashBucketLoad - 1) / HashBucketLoad);
+        buckets.init(bucketCount);
+        for (KeyBucket &bucket : buckets) {
+            bucket.fill(HashEmptyKey, int(NOT_FOUND));
+        }
+
+        keyCount = 0;
+        minPosition = haystackCount && hayStack[0] == HashEmptyKey ? 0 : NOT_FOUND;
+        for (int64_t c = 0; c < haystackCount; c++) {
+            if (c + HashPrefetchDistance < haystackCount) {
+                const int ahead = hayStack[c + HashPrefetchDistance];
+                _mm_prefetch(reinterpret_cast<const char *>(buckets.get() + bucketOf(ahead)),
+                    _MM_HINT_T0);
+            }
+            const int key = hayStack[c];
+            if ((c > 0 && key == hayStack[c - 1]) || key == HashEmptyKey) {
+                continue;
+            }
+            int64_t b = bucketOf(key);
+            while (true) {
+                KeyBucket &bucket = buckets[b];
+                const int slot = int(std::find(bucket.keys, bucket.keys + KeyBucketKeys,
+                    HashEmptyKey) - bucket.keys);
+                if (slot < KeyBucketKeys) {
+                    bucket.keys[slot] = key;
+                    bucket.positions[slot] = int(c);
+                    break;
+                }
+                b = b + 1 == bucketCount ? 0 : b + 1;
+            }
+            keyCount++;
+        }
+        return true;
+    }
+
+    int64_t bucketOf(int key) const
+    {
+        return int64_t((uint64_t(keyHash(key)) * uint64_t(bucketCount)) >> 32);
+    }
+
+    /// Bytes of the table, without the haystack
+    int64_t memoryBytes() const
+    {
+        return bucketCount * int64_t(sizeof(KeyBucket));
+    }
+
+    /// @return index of the first element equal to @value or -1
+    int64_t find(int value, int64_t bucketIdx) const
+    {
+        if (value == HashEmptyKey) {
+            return minPosition;
+        }
+        int64_t index;
+        for (int64_t b = bucketIdx;; b = b + 1 == bucketCount ? 0 : b + 1) {
+            const KeyBucket &bucket = buckets.get()[b];
+            if (bucket.probe(value, index)) {
+                return index;
+            }
+            if (bucket.match(HashEmptyKey)) {
+                return NOT_FOUND;
+            }
+        }
+    }
+
+    /// Look up every needle, the buckets of 8 needles are computed with three multiplies and
+    /// stored in @bucketIdx, then each bucket is prefetched HashPrefetchDistance needles before
+    /// its probe
+    /// @param bucketIdx - scratch of needles.count values
+    void findBatch(const AlignedIntArray &needles, AlignedIndexArray &indices,
+        int64_t *bucketIdx) const
+    {
+        const int64_t needlesCount = needles.getCount();
+        const __m256i countV = _mm256_set1_epi64x(bucketCount);
+        int64_t c = 0;
+        for (; c + 8 <= needlesCount; c += 8) {
+            const __m256i value =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(needles.get() + c));
+            const __m256i product = keyHash8(value);
+            // high halves of the 64 bit products with bucketCount, even lanes then odd lanes
+            const __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(product, countV), 32);
+            const __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(product, 32), countV);
+            const __m256i hash = _mm256_blend_epi32(even, odd, 0xAA);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(bucketIdx + c),
+                _mm256_cvtepu32_epi64(_mm256_castsi256_si128(hash)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(bucketIdx + c + 4),
+                _mm256_cvtepu32_epi64(_mm256_extracti128_si256(hash, 1)));
+        }
+        for (; c < needlesCount; c++) {
+            bucketIdx[c] = bucketOf(needles[c]);
+        }
+
+        const KeyBucket *bucketPtr = buckets.get();
+        for (c = 0; c < needlesCount; c++) {
+            if (c + HashPrefetchDistance < needlesCount) {
+                const KeyBucket *ahead = bucketPtr + bucketIdx[c + HashPrefetchDistance];
+                _mm_prefetch(reinterpret_cast<const char *>(ahead), _MM_HINT_T0);
+            }
+            indices[c] = find(needles[c], bucketIdx[c]);
+        }
+    }
+};
+} // namespace
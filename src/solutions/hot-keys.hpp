@@ -0,0 +1,241 @@
+#pragma once
+
+#include "utils.hpp"
+#include "key-bucket.hpp"
+#include "single-lookup.hpp"
+#include "simd-avx256.hpp"
+
+#ifndef __clang__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <utility>
+#include <vector>
+
+/// log2 of the buckets of a HotKeyTable, 128 buckets of one cache line fit in 8KB of L1
+const int HotBucketBits = 7;
+/// Most needles of the query log that are counted, longer logs are sampled with a stride
+const int64_t HotSampleCount = 1 << 16;
+/// Keys seen fewer times in the sample are not hot, a key seen twice in 2^16 needles of a
+/// uniform batch is chance
+const int64_t HotMinCount = 4;
+/// Tables whose keys make a smaller share of the sample are dropped, most probes would miss and
+/// only add to the search
+const double HotMinShare = 0.125;
+
+namespace {
+/// Answers of the most frequent keys of a query log, picked by count and not by position
+/// Keys are inserted from the most frequent down, a key whose bucket is full is left out, so
+/// collisions only ever push out colder keys
+/// Missing keys can be hot too, their answer is NOT_FOUND
+struct HotKeyTable {
+    AlignedArrayPtr<KeyBucket> buckets;
+    int64_t hotCount = 0;
+
+    /// @param queryLog - sample of the lookups, keys that repeat in it are hot
+    /// @param logCount - number of keys in @queryLog
+    void init(const AlignedIntArray &hayStack, const int *queryLog, int64_t logCount)
+    {
+        hotCount = 0;
+        // positions are kept in 32 bits
+        if (hayStack.getCount() > INT_MAX || logCount <= 0) {
+            return;
+        }
+
+        const int64_t stride = std::max<int64_t>(1, logCount / HotSampleCount);
+        std::vector<int> sample;
+        sample.reserve(logCount / stride);
+        for (int64_t c = 0; c < logCount; c += stride) {
+            sample.push_back(queryLog[c]);
+        }
+        std::sort(sample.begin(), sample.end());
+
+        // (count, key) of every key that repeats, the most frequent first
+        std::vector<std::pair<int64_t, int>> hot;
+        for (size_t c = 0; c < sample.size();) {
+            size_t end = c + 1;
+            while (end < sample.size() && sample[end] == sample[c]) {
+                end++;
+            }
+            if (int64_t(end - c) >= HotMinCount) {
+                hot.emplace_back(end - c, sample[c]);
+            }
+            c = end;
+        }
+        if (hot.empty()) {
+            return;
+        }
+        std::sort(hot.begin(), hot.end(), [](const auto &a, const auto &b) {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        });
+
+        auto answer = [&](int key) {
+            const int *pos = std::lower_bound(hayStack.begin(), hayStack.end(), key);
+            return pos != hayStack.end() && *pos == key ? int(pos - hayStack.begin()) : NOT_FOUND;
+        };
+
+        // unused slots repeat the hottest key, a match on them still gives a correct answer
+        const int fillKey = hot[0].second;
+        const int fillPosition = answer(fillKey);
+        buckets.init(1 << HotBucketBits);
+        for (KeyBucket &bucket : buckets) {
+            bucket.fill(fillKey, fillPosition);
+        }
+
+        std::vector<int> used(1 << HotBucketBits, 0);
+        int64_t covered = 0;
+        for (const auto &[count, key] : hot) {
+            const int b = bucketOf(key);
+            if (used[b] < KeyBucketKeys) {
+                buckets[b].keys[used[b]] = key;
+                buckets[b].positions[used[b]] = answer(key);
+                used[b]++;
+                hotCount++;
+                covered += count;
+            }
+        }
+        if (double(covered) < HotMinShare * double(sample.size())) {
+            hotCount = 0;
+        }
+    }
+
+    /// Bytes of the buckets, none when no key is hot
+    int64_t memoryBytes() const
+    {
+        return hotCount ? buckets.getCount() * int64_t(sizeof(KeyBucket)) : 0;
+    }
+
+    static int bucketOf(int key)
+    {
+        return int(keyHash(key) >> (32 - HotBucketBits));
+    }
+
+    /// Look for @value in its bucket
+    /// @param bucketIdx - bucketOf(value)
+    /// @param index [out] - index of the first element equal to @value or -1, set on a hit
+    /// @return true if @value is a hot key
+    bool probe(int value, int bucketIdx, int64_t &index) const
+    {
+        return buckets[bucketIdx].probe(value, index);
+    }
+};
+
+/// LatencySearch with a HotKeyTable in front of it, the hot keys of the query log are answered
+/// from one cache line of the table and the rest go down the bin and the haystack
+/// The haystack is not copied and must outlive the index
+struct HotKeySearch {
+    HotKeyTable hot;
+    LatencySearch rest;
+
+    void init(const AlignedIntArray &hayStack, const int *queryLog, int64_t logCount)
+    {
+        rest.init(hayStack);
+        hot.init(hayStack, queryLog, logCount);
+    }
+
+    /// @return index of the first element equal to @value or -1
+    int64_t find(int value) const
+    {
+        int64_t index;
+        if (hot.hotCount && hot.probe(value, HotKeyTable::bucketOf(value), index)) {
+            return index;
+        }
+        return rest.find(value);
+    }
+};
+} // namespace
+
+/// avx256 for skewed batches with a table built by the caller
+/// Hot needles are answered from @hot, the bucket of 8 needles is hashed with one multiply, the
+/// other needles are packed and searched with avx256
+static void avx256HotKeysTable(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator,
+    const HotKeyTable &hot)
+{
+    const int64_t needlesCount = needles.count;
+    if (!hot.hotCount) {
+        return avx256(hayStack, needles, indices, allocator);
+    }
+
+    const ArenaAllocator::Scope scope(allocator);
+    int *missNeedles = allocator.alloc<int>(needlesCount);
+    int64_t *missIndices = allocator.alloc<int64_t>(needlesCount);
+    int64_t *missPositions = allocator.alloc<int64_t>(needlesCount);
+    if (!missNeedles || !missIndices || !missPositions) {
+        return avx256(hayStack, needles, indices, allocator);
+    }
+
+    alignas(32) int bucketIdx[8];
+    int64_t missCount = 0;
+    int64_t c = 0;
+    for (; c + 8 <= needlesCount; c += 8) {
+        const __m256i value =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(needles.aligned + c));
+        // same as HotKeyTable::bucketOf
+        const __m256i hash = _mm256_srli_epi32(keyHash8(value), 32 - HotBucketBits);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(bucketIdx), hash);
+
+        for (int r = 0; r < 8; r++) {
+            const int needle = needles[c + r];
+            if (!hot.probe(needle, bucketIdx[r], indices[c + r])) {
+                missNeedles[missCount] = needle;
+                missPositions[missCount] = c + r;
+                missCount++;
+            }
+        }
+    }
+    for (; c < needlesCount; c++) {
+        if (!hot.probe(needles[c], HotKeyTable::bucketOf(needles[c]), indices[c])) {
+            missNeedles[missCount] = needles[c];
+            missPositions[missCount] = c;
+            missCount++;
+        }
+    }
+
+    if (missCount) {
+        AlignedIntArray missView;
+        AlignedIndexArray missIndexView;
+        missView.view(missNeedles, missCount);
+        missIndexView.view(missIndices, missCount);
+        avx256(hayStack, missView, missIndexView, allocator);
+        for (int64_t m = 0; m < missCount; m++) {
+            indices[missPositions[m]] = missIndices[m];
+        }
+    }
+}
+
+namespace {
+/// avx256HotKeysTable with the table built once by init from a query log, without a log no key
+/// is hot and every batch goes to avx256
+/// The haystack is not copied and must outlive the index
+struct Avx256HotKeySearch {
+    const AlignedIntArray *hayStack = nullptr;
+    HotKeyTable hot;
+
+    void init(const AlignedIntArray &newHayStack, const AlignedIntArray *queryLog)
+    {
+        hayStack = &newHayStack;
+        if (queryLog) {
+            hot.init(newHayStack, queryLog->get(), queryLog->getCount());
+        }
+    }
+
+    /// Bytes of the table, without the haystack
+    int64_t memoryBytes() const
+    {
+        return hot.memoryBytes();
+    }
+
+    void search(
+        const AlignedIntArray &needles, AlignedIndexArray &indices, ArenaAllocator &allocator) const
+    {
+        avx256HotKeysTable(*hayStack, needles, indices, allocator, hot);
+    }
+};
+} // namespace
@@ -0,0 +1,178 @@
+#pragma once
+
+#include "utils.hpp"
+
+#ifndef __clang__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <bit>
+
+/// Match pairs in a buffer of avx256Intersect that stays in L2, 64KB
+const int64_t IntersectBufferPairs = 1 << 12;
+
+/// One match of a join, needles[needleIndex] == hayStack[hayStackIndex]
+struct MatchPair {
+    int64_t needleIndex;
+    int64_t hayStackIndex;
+};
+
+namespace {
+/// Fixed size buffer of match pairs, full buffers are passed to @flush(const MatchPair *, count)
+template <typename Flush>
+struct MatchPairSink {
+    MatchPair *pairs;
+    int64_t capacity;
+    Flush &flush;
+    int64_t count = 0;
+    int64_t total = 0;
+
+    void push(int64_t needleIndex, int64_t hayStackIndex)
+    {
+        if (count == capacity) {
+            drain();
+        }
+        pairs[count++] = MatchPair{needleIndex, hayStackIndex};
+    }
+
+    void drain()
+    {
+        if (count) {
+            flush(static_cast<const MatchPair *>(pairs), count);
+            total += count;
+            count = 0;
+        }
+    }
+};
+
+/// First index in [@from, @count) with values[index] >= @value, exponential steps then binary
+/// search, the cost grows with the log of the distance skipped and not of the array
+int64_t gallopLowerBound(const int *values, int64_t from, int64_t count, int value)
+{
+    int64_t step = 1;
+    int64_t low = from;
+    while (from + step < count && values[from + step] < value) {
+        low = from + step + 1;
+        step *= 2;
+    }
+    int64_t high = std::min(from + step, count);
+    while (low < high) {
+        const int64_t middle = low + (high - low) / 2;
+        if (values[middle] < value) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/// Merge join of the values left after the blocks, one side has less than 8 of them so the
+/// other side is galloped over
+/// A tie advances the haystack so its duplicates all match
+template <typename Sink>
+void scalarIntersect(const int *needles, int64_t i, int64_t needlesCount,
+    const int *hayStack, int64_t j, int64_t haystackCount, Sink &sink)
+{
+    while (i < needlesCount && j < haystackCount) {
+        if (needles[i] < hayStack[j]) {
+            i = gallopLowerBound(needles, i, needlesCount, hayStack[j]);
+        } else if (hayStack[j] < needles[i]) {
+            j = gallopLowerBound(hayStack, j, haystackCount, needles[i]);
+        } else {
+            sink.push(i, j);
+            j++;
+        }
+    }
+}
+} // namespace
+
+/// Every (needle, haystack) position pair with equal values of two sorted arrays
+/// Blocks of 8 needles and 8 haystack values are compared all pairs with 8 rotations of the
+/// haystack block, the block with the smaller last value moves on and a tie moves the haystack
+/// block, so duplicates in the haystack spanning blocks all meet their needle
+/// Values of one side below the first value of the other side are skipped with a galloping
+/// search, so a sparse side costs the log of the gaps and not a scan of the dense side
+/// Pairs are buffered in @buffer and handed to @flush when it is full and at the end, memory
+/// stays bounded by the buffer for any number of matches
+/// @param needles - sorted, no duplicates
+/// @param hayStack - sorted, may have duplicates
+/// @param buffer - room for @bufferCount pairs, pairs of one 8x8 block are in no particular order
+/// @param flush - called as flush(const MatchPair *pairs, int64_t count)
+/// @return the number of match pairs
+template <typename Flush>
+int64_t avx256Intersect(const AlignedIntArray &needles, const AlignedIntArray &hayStack,
+    MatchPair *buffer, int64_t bufferCount, Flush &&flush)
+{
+    const int *needlePtr = needles.get();
+    const int *haystackPtr = hayStack.get();
+    const int64_t needlesCount = needles.getCount();
+    const int64_t haystackCount = hayStack.getCount();
+    MatchPairSink<Flush> sink{buffer, bufferCount, flush};
+
+    const __m256i rotate = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+    int64_t i = 0;
+    int64_t j = 0;
+    while (i + 8 <= needlesCount && j + 8 <= haystackCount) {
+        if (haystackPtr[j + 7] < needlePtr[i]) {
+            j = gallopLowerBound(haystackPtr, j + 8, haystackCount, needlePtr[i]);
+            continue;
+        }
+        if (needlePtr[i + 7] < haystackPtr[j]) {
+            i = gallopLowerBound(needlePtr, i + 8, needlesCount, haystackPtr[j]);
+            continue;
+        }
+
+        // a run of haystack duplicates matches only the first needle, it is copied without
+        // compares, there are no duplicates of the needle so it is done after the run
+        if (haystackPtr[j] == needlePtr[i] && haystackPtr[j + 7] == needlePtr[i]) {
+            for (; j < haystackCount && haystackPtr[j] == needlePtr[i]; j++) {
+                sink.push(i, j);
+            }
+            i++;
+            continue;
+        }
+
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(needlePtr + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(haystackPtr + j));
+        // lane k of rotation r compares needle k with haystack value (k + r) % 8
+        __m256i eq[8];
+        __m256i any = _mm256_setzero_si256();
+        for (int r = 0; r < 8; r++) {
+            eq[r] = _mm256_cmpeq_epi32(a, b);
+            any = _mm256_or_si256(any, eq[r]);
+            b = _mm256_permutevar8x32_epi32(b, rotate);
+        }
+
+        if (!_mm256_testz_si256(any, any)) {
+            for (int r = 0; r < 8; r++) {
+                unsigned mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq[r]));
+                while (mask) {
+                    const int k = std::countr_zero(mask);
+                    sink.push(i + k, j + ((k + r) & 7));
+                    mask &= mask - 1;
+                }
+            }
+        }
+
+        // values of one side below the first of the other side have all their matches out,
+        // the blocks restart at the next values that can still match
+        if (haystackPtr[j + 7] <= needlePtr[i + 7]) {
+            j += 8;
+            if (j < haystackCount) {
+                i = gallopLowerBound(needlePtr, i, needlesCount, haystackPtr[j]);
+            }
+        } else {
+            i += 8;
+            if (i < needlesCount) {
+                j = gallopLowerBound(haystackPtr, j, haystackCount, needlePtr[i]);
+            }
+        }
+    }
+
+    // all matches of needles before i and of haystack values before j are already out
+    scalarIntersect(needlePtr, i, needlesCount, haystackPtr, j, haystackCount, sink);
+    sink.drain();
+    return sink.total;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "utils.hpp"
+#include "baseline.hpp"
+#include "linear-scan.hpp"
+
+#ifndef __clang__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+
+/// Pivots compared per step, one AVX2 register, each step keeps 1 / (KaryPivots + 1) of the range
+const int KaryPivots = 8;
+
+namespace {
+/// One step of the k-ary search of @value, the lower bound is in [@left, @right]
+inline void karyStep(const int *haystackPtr, int value, int64_t &left, int64_t &right)
+{
+    const __m256i pivotNumber = _mm256_set_epi32(8, 7, 6, 5, 4, 3, 2, 1);
+    const int64_t count = right - left;
+    // the ranges between pivots have step - 1 elements and the last one at most that
+    const int step = int((count + KaryPivots) / (KaryPivots + 1));
+
+    // pivot i is at left + (i + 1) * step - 1, clamped to the range for small counts
+    const __m256i offset = _mm256_min_epi32(
+        _mm256_sub_epi32(
+            _mm256_mullo_epi32(pivotNumber, _mm256_set1_epi32(step)), _mm256_set1_epi32(1)),
+        _mm256_set1_epi32(int(count - 1)));
+    const __m256i pivots = _mm256_i32gather_epi32(haystackPtr + left, offset, sizeof(int));
+    const int ltMask = _mm256_movemask_ps(
+        _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(value), pivots)));
+
+    // pivots are sorted, so the ones less than the needle are the low lanes
+    const int less = std::popcount(unsigned(ltMask));
+    if (less < KaryPivots) {
+        right = left + std::min<int64_t>(int64_t(less + 1) * step, count) - 1;
+    }
+    left += std::min<int64_t>(int64_t(less) * step, count);
+}
+} // namespace
+
+/// k-ary search with k = 9 on the plain sorted haystack, no relayout and no extra memory
+/// Each step gathers 8 evenly spaced pivots of the current range, the number of pivots less than
+/// the needle picks the part of the range to keep, so there are log9(n) dependent steps instead of
+/// the log2(n) of binarySearch
+/// The steps of KaryGroup needles are interleaved so the gathers of different needles overlap
+template <int KaryGroup = 8>
+static void avx256KarySearch(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
+{
+    const int64_t haystackCount = hayStack.count;
+    const int64_t needlesCount = needles.count;
+    const int *haystackPtr = hayStack.aligned;
+
+    if (haystackCount <= LinearScanMaxCount) {
+        return avx256LinearScan(hayStack, needles, indices, allocator);
+    }
+    // pivot offsets are 32 bit
+    if (haystackCount > INT_MAX) {
+        return binarySearch(hayStack, needles, indices);
+    }
+
+    for (int64_t c = 0; c < needlesCount; c += KaryGroup) {
+        const int groupCount = int(std::min<int64_t>(KaryGroup, needlesCount - c));
+        int64_t left[KaryGroup];
+        int64_t right[KaryGroup];
+        for (int g = 0; g < groupCount; g++) {
+            left[g] = 0;
+            right[g] = haystackCount;
+        }
+
+        // all needles start from the same range, so they finish within a step of each other
+        bool searching = true;
+        while (searching) {
+            searching = false;
+            for (int g = 0; g < groupCount; g++) {
+                if (left[g] < right[g]) {
+                    karyStep(haystackPtr, needles[c + g], left[g], right[g]);
+                    searching = true;
+                }
+            }
+        }
+
+        for (int g = 0; g < groupCount; g++) {
+            const int value = needles[c + g];
+            indices[c + g] =
+                left[g] < haystackCount && haystackPtr[left[g]] == value ? left[g] : NOT_FOUND;
+        }
+    }
+}
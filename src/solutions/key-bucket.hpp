@@ -0,0 +1,64 @@
+#pragma once
+
+#include "utils.hpp"
+
+#ifndef __clang__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <bit>
+
+/// Keys of a KeyBucket, one AVX2 compare checks all of them
+const int KeyBucketKeys = 8;
+/// Multiplier of the hash of the keys, 2^32 divided by the golden ratio
+const uint32_t KeyHashMultiplier = 0x9E3779B1u;
+
+namespace {
+/// Keys and their positions share a cache line, a probe reads nothing else
+/// Shared by HashIndex and HotKeyTable, which only differ in how they pick the bucket of a key
+struct alignas(64) KeyBucket {
+    int keys[KeyBucketKeys];
+    int positions[KeyBucketKeys];
+
+    /// Set every slot to @key and @position
+    void fill(int key, int position)
+    {
+        std::fill(keys, keys + KeyBucketKeys, key);
+        std::fill(positions, positions + KeyBucketKeys, position);
+    }
+
+    /// @return bit i set when keys[i] is @value
+    unsigned match(int value) const
+    {
+        const __m256i keysV = _mm256_load_si256(reinterpret_cast<const __m256i *>(keys));
+        const __m256i eq = _mm256_cmpeq_epi32(keysV, _mm256_set1_epi32(value));
+        return _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+    }
+
+    /// Look for @value in the bucket
+    /// @param index [out] - position of the first slot with @value, set on a hit
+    /// @return true if @value is a key of the bucket
+    bool probe(int value, int64_t &index) const
+    {
+        const unsigned hit = match(value);
+        if (!hit) {
+            return false;
+        }
+        index = positions[std::countr_zero(hit)];
+        return true;
+    }
+};
+
+/// Multiplicative hash of @key, the bucket is picked from its high bits
+inline uint32_t keyHash(int key)
+{
+    return uint32_t(key) * KeyHashMultiplier;
+}
+
+/// keyHash of the 8 keys in @keys
+inline __m256i keyHash8(__m256i keys)
+{
+    return _mm256_mullo_epi32(keys, _mm256_set1_epi32(int(KeyHashMultiplier)));
+}
+} // namespace
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "utils.hpp"
+#include "output-writers.hpp"
+
+#ifndef __clang__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <cmath>
+
+/// Haystacks up to this size are searched with avx256LinearScan by the AVX2 solutions
+const int64_t LinearScanMaxCount = 1024 * 100;
+/// Haystacks up to this size are scanned whole, bigger ones go through a level of samples
+const int64_t LinearScanDirectCount = 64;
+
+namespace {
+/// Number of values in [ptr, ptr + count) less than @value, 8 compares per instruction
+inline int64_t avx256CountLess(const int *ptr, int64_t count, __m256i value)
+{
+    int64_t less = 0;
+    int64_t c = 0;
+    for (; c + 16 <= count; c += 16) {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr + c));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr + c + 8));
+        const int maskA = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(value, a)));
+        const int maskB = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(value, b)));
+        less += std::popcount(unsigned(maskA | maskB << 8));
+    }
+    for (; c < count; c += 8) {
+        // lanes past the end are not loaded and not counted
+        const __m256i lane = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+        const __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(int(count - c)), lane);
+        const __m256i values = _mm256_maskload_epi32(ptr + c, valid);
+        const __m256i lt = _mm256_and_si256(_mm256_cmpgt_epi32(value, values), valid);
+        less += std::popcount(unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(lt))));
+    }
+    return less;
+}
+} // namespace
+
+/// Search for small haystacks that fit in L1/L2: the lower bound is the number of values less
+/// than the needle, counted with AVX2 compares and popcount without any data dependent branch
+/// Haystacks above LinearScanDirectCount are split in blocks of ~sqrt(n) values and the last
+/// value of each block is copied to a sample array, scanning the samples gives the block and
+/// scanning the block gives the index
+/// The results are passed to writer.store
+template <typename Writer>
+static void avx256LinearScanWrite(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    Writer &writer,
+    ArenaAllocator &allocator)
+{
+    const int64_t haystackCount = hayStack.count;
+    const int *haystackPtr = hayStack.aligned;
+
+    if (haystackCount <= LinearScanDirectCount) {
+        for (int64_t c = 0; c < needles.count; c++) {
+            const int value = needles[c];
+            const int64_t left =
+                avx256CountLess(haystackPtr, haystackCount, _mm256_set1_epi32(value));
+            writer.store(
+                c, left < haystackCount && haystackPtr[left] == value ? left : NOT_FOUND);
+        }
+        return;
+    }
+
+    // multiple of 16 so both levels are scanned without a tail
+    const int64_t blockSize = (int64_t(std::sqrt(double(haystackCount))) + 15) & -16;
+    const int64_t blockCount = (haystackCount + blockSize - 1) / blockSize;
+    const int64_t sampleCount = (blockCount + 15) & -16;
+    const ArenaAllocator::Scope scope(allocator);
+    int *samples = allocator.alloc<int>(sampleCount);
+    if (!samples) {
+        for (int64_t c = 0; c < needles.count; c++) {
+            const int value = needles[c];
+            const int64_t left = std::lower_bound(haystackPtr, haystackPtr + haystackCount, value) -
+                haystackPtr;
+            writer.store(
+                c, left < haystackCount && haystackPtr[left] == value ? left : NOT_FOUND);
+        }
+        return;
+    }
+
+    for (int64_t b = 0; b < blockCount; b++) {
+        samples[b] = haystackPtr[std::min((b + 1) * blockSize, haystackCount) - 1];
+    }
+    // padding is never less than a needle
+    for (int64_t b = blockCount; b < sampleCount; b++) {
+        samples[b] = INT_MAX;
+    }
+
+    for (int64_t c = 0; c < needles.count; c++) {
+        const int value = needles[c];
+        const __m256i valueV = _mm256_set1_epi32(value);
+
+        // blocks whose last value is less than the needle are entirely less than it
+        const int64_t block = avx256CountLess(samples, sampleCount, valueV);
+        if (block == blockCount) {
+            writer.store(c, NOT_FOUND);
+            continue;
+        }
+
+        const int64_t blockStart = block * blockSize;
+        const int64_t blockLength = std::min(blockSize, haystackCount - blockStart);
+        const int64_t left =
+            blockStart + avx256CountLess(haystackPtr + blockStart, blockLength, valueV);
+        writer.store(c, haystackPtr[left] == value ? left : NOT_FOUND);
+    }
+}
+
+/// avx256LinearScanWrite storing the index of every needle
+inline void avx256LinearScan(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
+{
+    IndexWriter writer{indices.aligned};
+    avx256LinearScanWrite(hayStack, needles, writer, allocator);
+}
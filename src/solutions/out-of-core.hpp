@@ -0,0 +1,583 @@
+#pragma once
+
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#if BSEARCH_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+/// One read of @bytes bytes at @offset in the file into @buffer
+struct PageRead {
+    int64_t offset;
+    int bytes;
+    void *buffer;
+};
+
+/// Reads batches of byte ranges from a file
+/// Uses io_uring when built with BSEARCH_IO_URING and the kernel allows it, pread otherwise
+struct PageReader {
+    PageReader() = default;
+    PageReader(const PageReader &) = delete;
+    PageReader &operator=(const PageReader &) = delete;
+
+    ~PageReader()
+    {
+        close();
+    }
+
+    /// Open @name for reading
+    /// @param queueDepth - max number of reads in flight at once
+    bool open(const char *name, int queueDepth)
+    {
+        close();
+        fileFd = ::open(name, O_RDONLY);
+        if (fileFd < 0) {
+            return false;
+        }
+#if BSEARCH_IO_URING
+        setupRing(std::max(1, queueDepth));
+#endif
+        return true;
+    }
+
+    void close()
+    {
+#if BSEARCH_IO_URING
+        closeRing();
+#endif
+        if (fileFd >= 0) {
+            ::close(fileFd);
+            fileFd = -1;
+        }
+    }
+
+    /// Read all of @reads, in groups of up to queueDepth
+    /// @return true if all reads got all of their bytes
+    bool read(PageRead *reads, int count)
+    {
+#if BSEARCH_IO_URING
+        if (ringFd >= 0) {
+            return readRing(reads, count);
+        }
+#endif
+        bool allOk = true;
+        for (int c = 0; c < count; c++) {
+            allOk &= readBlocking(reads[c]);
+        }
+        return allOk;
+    }
+
+    /// Read a single range with pread, retrying short reads
+    bool readBlocking(const PageRead &read) const
+    {
+        uint8_t *buffer = static_cast<uint8_t *>(read.buffer);
+        int64_t done = 0;
+        while (done < read.bytes) {
+            const ssize_t got = pread(fileFd, buffer + done, read.bytes - done, read.offset + done);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                return false;
+            }
+            done += got;
+        }
+        return true;
+    }
+
+    /// Name of the backend used for reads
+    const char *backend() const
+    {
+#if BSEARCH_IO_URING
+        if (ringFd >= 0) {
+            return "io_uring";
+        }
+#endif
+        return "pread";
+    }
+
+private:
+    int fileFd = -1;
+
+#if BSEARCH_IO_URING
+    /// Map the submission and completion rings, on failure reads fall back to pread
+    void setupRing(int queueDepth)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        const int fd = int(syscall(__NR_io_uring_setup, queueDepth, &params));
+        if (fd < 0) {
+            return;
+        }
+
+        sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        cqRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        sqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+        const bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap) {
+            sqRingBytes = cqRingBytes = std::max(sqRingBytes, cqRingBytes);
+        }
+
+        const int prot = PROT_READ | PROT_WRITE;
+        const int flags = MAP_SHARED | MAP_POPULATE;
+        sqRing = static_cast<uint8_t *>(mmap(0, sqRingBytes, prot, flags, fd, IORING_OFF_SQ_RING));
+        cqRing = singleMap ? sqRing
+                           : static_cast<uint8_t *>(
+                                 mmap(0, cqRingBytes, prot, flags, fd, IORING_OFF_CQ_RING));
+        void *sqesMap = mmap(0, sqesBytes, prot, flags, fd, IORING_OFF_SQES);
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqesMap == MAP_FAILED) {
+            // unmapping MAP_FAILED is harmless, it is not a valid mapping
+            munmap(sqesMap, sqesBytes);
+            munmap(cqRing, cqRingBytes);
+            munmap(sqRing, sqRingBytes);
+            ::close(fd);
+            return;
+        }
+
+        sqes = static_cast<io_uring_sqe *>(sqesMap);
+        sqTail = reinterpret_cast<uint32_t *>(sqRing + params.sq_off.tail);
+        sqMask = *reinterpret_cast<uint32_t *>(sqRing + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<uint32_t *>(sqRing + params.sq_off.array);
+        cqHead = reinterpret_cast<uint32_t *>(cqRing + params.cq_off.head);
+        cqTail = reinterpret_cast<uint32_t *>(cqRing + params.cq_off.tail);
+        cqMask = *reinterpret_cast<uint32_t *>(cqRing + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cqRing + params.cq_off.cqes);
+        ringEntries = int(params.sq_entries);
+        ringFd = fd;
+    }
+
+    /// Unmap the rings and close the ring, later reads use pread
+    void closeRing()
+    {
+        if (ringFd >= 0) {
+            munmap(sqes, sqesBytes);
+            if (cqRing != sqRing) {
+                munmap(cqRing, cqRingBytes);
+            }
+            munmap(sqRing, sqRingBytes);
+            ::close(ringFd);
+            ringFd = -1;
+        }
+    }
+
+    /// Submit up to ringEntries reads with one system call and wait for all of them
+    /// Reads that fail or come back short (or kernels without IORING_OP_READ) are redone with pread
+    /// If io_uring_enter fails, the reads in flight are waited for and the ring is closed, this
+    /// batch, the rest and all later calls use pread
+    bool readRing(PageRead *reads, int count)
+    {
+        bool allOk = true;
+        int submitted = 0;
+        int completed = 0;
+        const auto reapCompletions = [&] {
+            uint32_t head = *cqHead;
+            const uint32_t available = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != available; ++head) {
+                const io_uring_cqe &cqe = cqes[head & cqMask];
+                const PageRead &read = reads[cqe.user_data];
+                if (cqe.res != read.bytes) {
+                    allOk &= readBlocking(read);
+                }
+                ++completed;
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        };
+
+        for (int start = 0; start < count; start += ringEntries) {
+            const int batch = std::min(count - start, ringEntries);
+
+            // only this thread writes the tail, so a plain load is enough
+            uint32_t tail = *sqTail;
+            for (int r = 0; r < batch; r++) {
+                const uint32_t index = tail & sqMask;
+                const PageRead &read = reads[start + r];
+                io_uring_sqe &sqe = sqes[index];
+                memset(&sqe, 0, sizeof(sqe));
+                sqe.opcode = IORING_OP_READ;
+                sqe.fd = fileFd;
+                sqe.addr = uint64_t(read.buffer);
+                sqe.len = uint32_t(read.bytes);
+                sqe.off = uint64_t(read.offset);
+                sqe.user_data = uint64_t(start + r);
+                sqArray[index] = index;
+                ++tail;
+            }
+            __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+
+            submitted = 0;
+            completed = 0;
+            while (completed < batch) {
+                const int ret = int(syscall(
+                    __NR_io_uring_enter,
+                    ringFd,
+                    batch - submitted,
+                    1,
+                    IORING_ENTER_GETEVENTS,
+                    nullptr,
+                    0));
+                if (ret < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    // wait for the reads in flight so none of them writes to a buffer after the
+                    // return, the SQEs that were not submitted are dropped with the ring
+                    while (completed < submitted) {
+                        const int waited = int(syscall(
+                            __NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+                        if (waited < 0 && errno != EINTR) {
+                            break;
+                        }
+                        reapCompletions();
+                    }
+                    closeRing();
+                    for (int r = start; r < count; r++) {
+                        allOk &= readBlocking(reads[r]);
+                    }
+                    return allOk;
+                }
+                submitted += ret;
+                reapCompletions();
+            }
+        }
+        return allOk;
+    }
+
+    int ringFd = -1;
+    int ringEntries = 0;
+    uint8_t *sqRing = nullptr;
+    uint8_t *cqRing = nullptr;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqRingBytes = 0;
+    size_t cqRingBytes = 0;
+    size_t sqesBytes = 0;
+    uint32_t *sqTail = nullptr;
+    uint32_t sqMask = 0;
+    uint32_t *sqArray = nullptr;
+    uint32_t *cqHead = nullptr;
+    uint32_t *cqTail = nullptr;
+    uint32_t cqMask = 0;
+    io_uring_cqe *cqes = nullptr;
+#endif
+};
+
+/// Haystack that stays in a .bsearch file, only the first value of each page is kept in memory
+/// Needles are searched in batches: each batch is sorted by page, every page the batch needs is
+/// read once and the pages are kept in a fixed size cache with CLOCK eviction
+/// Pages are PageBytes of the file from offset 0, so every page read starts and ends on a 4KB
+/// boundary of the file, except the end of the last page; the first page holds the header and
+/// HeaderInts fewer values
+struct OutOfCoreHayStack {
+    static const int PageInts = 1024;
+    static const int PageBytes = PageInts * sizeof(int);
+    static const int64_t HeaderBytes = magicSize + 2 * sizeof(int64_t);
+    static const int64_t HeaderInts = HeaderBytes / sizeof(int);
+    static_assert(HeaderBytes % sizeof(int) == 0, "values must start on an int of the page grid");
+
+    struct Config {
+        /// Bytes of haystack pages kept in memory
+        int64_t cacheBytes = 64ll << 20;
+        /// Max number of page reads in flight at once
+        int queueDepth = 64;
+        /// Needles sorted and resolved together
+        int batchSize = 1 << 16;
+        /// Levels of the page directory kept in a bin as in eytzingerSearch
+        int binStepCount = 15;
+    };
+
+    /// Open the .bsearch file @name and build the page directory
+    bool open(const char *name, const Config &newConfig)
+    {
+        config = newConfig;
+        if (!reader.open(name, config.queueDepth)) {
+            return false;
+        }
+
+        char header[HeaderBytes];
+        if (!reader.readBlocking({0, int(HeaderBytes), header}) ||
+            strncmp(magic, header, magicSize)) {
+            printf("Bad magic constant in file [%s]\n", name);
+            return false;
+        }
+        int64_t sizes[2];
+        memcpy(sizes, header + magicSize, sizeof(sizes));
+        haystackCount = sizes[0];
+        needlesCount = sizes[1];
+        if (haystackCount <= 0) {
+            return false;
+        }
+
+        pageCount = (HeaderInts + haystackCount + PageInts - 1) / PageInts;
+        pageKeys.init(pageCount);
+
+        // stream the haystack once in big chunks of whole pages to pick the first value of each
+        const int64_t chunkPages = 256;
+        AlignedIntArray chunk(chunkPages * PageInts);
+        for (int64_t page = 0; page < pageCount; page += chunkPages) {
+            const int64_t ints =
+                std::min(chunkPages * PageInts, HeaderInts + haystackCount - page * PageInts);
+            const PageRead read = {page * PageBytes, int(ints * sizeof(int)), chunk.get()};
+            if (!reader.readBlocking(read)) {
+                return false;
+            }
+            for (int64_t p = page; p < std::min(page + chunkPages, pageCount); p++) {
+                pageKeys[p] = chunk[(p - page) * PageInts + (p == 0 ? HeaderInts : 0)];
+            }
+            lastValue = chunk[ints - 1];
+        }
+
+        // deeper levels would contain empty sub-ranges
+        stepCount = std::min(config.binStepCount, int(log2(pageCount + 1)));
+        bin.init((1 << stepCount) + 1);
+        precomputeBin(pageKeys, pageCount, bin, stepCount);
+
+        slotCount = int(std::max<int64_t>(2, config.cacheBytes / PageBytes));
+        cache.init(int64_t(slotCount) * PageInts);
+        slotPage.init(slotCount);
+        slotStamp.init(slotCount);
+        slotReferenced.init(slotCount);
+        slotPage.memset(0xFF);
+        slotStamp.memset(0);
+        slotReferenced.memset(0);
+        pageSlot.init(pageCount);
+        pageSlot.memset(0xFF);
+
+        pending.init(config.batchSize);
+        reads.init(config.queueDepth);
+        return true;
+    }
+
+    /// Read the needles stored after the haystack in the file
+    bool loadNeedles(AlignedIntArray &needles)
+    {
+        needles.init(needlesCount);
+        const int64_t chunkInts = 1 << 20;
+        for (int64_t c = 0; c < needlesCount; c += chunkInts) {
+            const int64_t ints = std::min(chunkInts, needlesCount - c);
+            const PageRead read = {HeaderBytes + (haystackCount + c) * int64_t(sizeof(int)),
+                                   int(ints * sizeof(int)),
+                                   needles.get() + c};
+            if (!reader.readBlocking(read)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Search all @needles, results are the same as for in-memory solutions
+    /// @return false if a page read failed
+    bool search(const AlignedIntArray &needles, AlignedIndexArray &indices)
+    {
+        for (int64_t c = 0; c < needles.getCount(); c += config.batchSize) {
+            const int batch = int(std::min<int64_t>(config.batchSize, needles.getCount() - c));
+            if (!searchBatch(needles.get() + c, batch, indices.get() + c)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Bytes in memory for the directory, the bin and the page cache
+    int64_t memoryBytes() const
+    {
+        return (pageKeys.getCount() + bin.getCount()) * sizeof(int) +
+               pageSlot.getCount() * sizeof(int) + cache.getCount() * sizeof(int) +
+               slotCount * (sizeof(int64_t) + sizeof(int64_t) + sizeof(uint8_t));
+    }
+
+    const char *backend() const
+    {
+        return reader.backend();
+    }
+
+    int64_t haystackCount = 0;
+    int64_t needlesCount = 0;
+    int64_t pageCount = 0;
+    /// Number of pages read from the file and number of page lookups served from the cache
+    int64_t pageReads = 0;
+    int64_t cacheHits = 0;
+
+private:
+    /// Count the pages whose first value is less than @value, the top levels come from the bin
+    int64_t pagesBelow(int value) const
+    {
+        int64_t left = 0;
+        int64_t count = pageCount;
+        int binIdx = 1;
+        int step = 0;
+
+        while (count > 0) {
+            const int64_t half = count / 2;
+
+            const int testValue = step < stepCount ? bin[binIdx] : pageKeys[left + half];
+            ++step;
+
+            if (testValue < value) {
+                left = left + half + 1;
+                count -= half + 1;
+                binIdx = binIdx * 2 + 1;
+            } else {
+                count = half;
+                binIdx = binIdx * 2;
+            }
+        }
+        return left;
+    }
+
+    /// Pick a slot for a new page with CLOCK, skipping slots used by the current window
+    int evictSlot()
+    {
+        while (true) {
+            const int slot = clockHand;
+            clockHand = clockHand + 1 == slotCount ? 0 : clockHand + 1;
+            if (slotStamp[slot] == windowStamp) {
+                continue;
+            }
+            if (slotReferenced[slot]) {
+                slotReferenced[slot] = 0;
+                continue;
+            }
+            if (slotPage[slot] != -1) {
+                pageSlot[slotPage[slot]] = -1;
+            }
+            return slot;
+        }
+    }
+
+    bool searchBatch(const int *needles, int batch, int64_t *indices)
+    {
+        // (page << 32 | needle index) for every needle that needs a page
+        int pendingCount = 0;
+        for (int c = 0; c < batch; c++) {
+            const int value = needles[c];
+            if (value < pageKeys[0] || value > lastValue) {
+                indices[c] = NOT_FOUND;
+                continue;
+            }
+            const int64_t below = pagesBelow(value);
+            if (below == 0) {
+                // value == pageKeys[0] since it is not less than it
+                indices[c] = 0;
+                continue;
+            }
+            pending[pendingCount++] = (uint64_t(below - 1) << 32) | uint32_t(c);
+        }
+        std::sort(pending.get(), pending.get() + pendingCount);
+
+        int windowBegin = 0;
+        while (windowBegin < pendingCount) {
+            // take the next distinct pages until the read queue is full or the cache is
+            // about to run out of slots
+            ++windowStamp;
+            int windowCount = 0;
+            int readCount = 0;
+            int windowEnd = windowBegin;
+            while (windowEnd < pendingCount && windowCount + 1 < slotCount &&
+                   readCount < config.queueDepth) {
+                const int64_t page = int64_t(pending[windowEnd] >> 32);
+                int slot = pageSlot[page];
+                if (slot == -1) {
+                    slot = evictSlot();
+                    slotPage[slot] = page;
+                    pageSlot[page] = slot;
+                    const int64_t ints =
+                        std::min<int64_t>(PageInts, HeaderInts + haystackCount - page * PageInts);
+                    reads[readCount++] = {page * PageBytes,
+                                          int(ints * sizeof(int)),
+                                          cache.get() + int64_t(slot) * PageInts};
+                } else {
+                    ++cacheHits;
+                }
+                slotStamp[slot] = windowStamp;
+                slotReferenced[slot] = 1;
+                ++windowCount;
+
+                while (windowEnd < pendingCount && int64_t(pending[windowEnd] >> 32) == page) {
+                    ++windowEnd;
+                }
+            }
+
+            pageReads += readCount;
+            if (!reader.read(reads, readCount)) {
+                return false;
+            }
+
+            for (int c = windowBegin; c < windowEnd; c++) {
+                const int64_t page = int64_t(pending[c] >> 32);
+                const int needle = int(uint32_t(pending[c]));
+                indices[needle] = searchPage(page, needles[needle]);
+            }
+            windowBegin = windowEnd;
+        }
+        return true;
+    }
+
+    /// Lower bound of @value in cached @page, continuing at the start of the next page
+    int64_t searchPage(int64_t page, int value) const
+    {
+        const int64_t first = pageFirst(page);
+        const int *pagePtr =
+            cache.get() + int64_t(pageSlot[page]) * PageInts + (page == 0 ? HeaderInts : 0);
+        const int pageLength = int(pageFirst(page + 1) - first);
+
+        int left = 0;
+        int count = pageLength;
+        while (count > 0) {
+            const int half = count / 2;
+
+            if (pagePtr[left + half] < value) {
+                left = left + half + 1;
+                count -= half + 1;
+            } else {
+                count = half;
+            }
+        }
+
+        if (left < pageLength) {
+            return pagePtr[left] == value ? first + left : NOT_FOUND;
+        }
+        // all values in the page are less, the next page's first value is not less
+        if (page + 1 < pageCount && pageKeys[page + 1] == value) {
+            return first + pageLength;
+        }
+        return NOT_FOUND;
+    }
+
+    /// Index of the first haystack value in @page, haystackCount for the page after the last
+    int64_t pageFirst(int64_t page) const
+    {
+        return std::clamp<int64_t>(page * PageInts - HeaderInts, 0, haystackCount);
+    }
+
+    Config config;
+    PageReader reader;
+    int lastValue = 0;
+    int stepCount = 0;
+    /// First value of every page and the top levels of their search tree
+    AlignedIntArray pageKeys;
+    AlignedIntArray bin;
+
+    int slotCount = 0;
+    int clockHand = 0;
+    int64_t windowStamp = 0;
+    AlignedIntArray cache;
+    AlignedArrayPtr<int64_t> slotPage;
+    AlignedArrayPtr<int64_t> slotStamp;
+    AlignedArrayPtr<uint8_t> slotReferenced;
+    /// Cache slot of each page or -1
+    AlignedIntArray pageSlot;
+
+    AlignedArrayPtr<uint64_t> pending;
+    AlignedArrayPtr<PageRead> reads;
+};
+} // namespace
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "utils.hpp"
+
+#ifndef __clang__
+#include <immintrin.h>
+#endif
+
+#include <bit>
+
+namespace {
+/// Sign extend the 8 32 bit indices in @indices32 and store them in @dst
+inline void storeIndices(int64_t *dst, __m256i indices32)
+{
+    const __m256i low = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(indices32));
+    const __m256i high = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(indices32, 1));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), low);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 4), high);
+}
+
+/// Output policies of the AVX2 searches, store8 gets the 32 bit lower bounds and the equality mask
+/// of the 8 needles from @c, @c is a multiple of 8, store4 gets the same for 4 needles with 64 bit
+/// lanes, @c is a multiple of 4, and store gets one result of a serial loop
+/// Writes the index of every needle or -1, as all solutions do
+struct IndexWriter {
+    int64_t *indicesPtr;
+
+    void store8(int64_t c, __m256i left, __m256i eqMask)
+    {
+        storeIndices(indicesPtr + c, _mm256_blendv_epi8(_mm256_set1_epi32(-1), left, eqMask));
+    }
+
+    void store4(int64_t c, __m256i left, __m256i eqMask)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(indicesPtr + c),
+            _mm256_blendv_epi8(_mm256_set1_epi64x(-1), left, eqMask));
+    }
+
+    void store(int64_t c, int64_t index)
+    {
+        indicesPtr[c] = index;
+    }
+};
+
+/// Writes one bit per needle, set when the needle is in the haystack
+struct BitmapWriter {
+    uint8_t *bits;
+
+    void store8(int64_t c, __m256i, __m256i eqMask)
+    {
+        bits[c >> 3] = uint8_t(_mm256_movemask_ps(_mm256_castsi256_ps(eqMask)));
+    }
+
+    void store4(int64_t c, __m256i, __m256i eqMask)
+    {
+        const int shift = int(c & 4);
+        const int found = _mm256_movemask_pd(_mm256_castsi256_pd(eqMask));
+        bits[c >> 3] = uint8_t((bits[c >> 3] & ~(0xF << shift)) | found << shift);
+    }
+
+    void store(int64_t c, int64_t index)
+    {
+        const uint8_t bit = uint8_t(1 << (c & 7));
+        bits[c >> 3] = index != NOT_FOUND ? bits[c >> 3] | bit : bits[c >> 3] & ~bit;
+    }
+};
+
+/// Only counts the needles found in the haystack
+struct CountWriter {
+    int64_t hits = 0;
+
+    void store8(int64_t, __m256i, __m256i eqMask)
+    {
+        hits += std::popcount(unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(eqMask))));
+    }
+
+    void store4(int64_t, __m256i, __m256i eqMask)
+    {
+        hits += std::popcount(unsigned(_mm256_movemask_pd(_mm256_castsi256_pd(eqMask))));
+    }
+
+    void store(int64_t, int64_t index)
+    {
+        hits += index != NOT_FOUND;
+    }
+};
+} // namespace
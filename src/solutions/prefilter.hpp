@@ -0,0 +1,188 @@
+#pragma once
+
+#include "utils.hpp"
+
+#ifndef __clang__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <bit>
+
+namespace {
+/// Membership filter over the haystack values, answers "may be present" or "surely absent"
+/// Narrow value ranges get an exact bitmap, all other haystacks get a split block Bloom filter
+/// where each value sets one bit in each of the 8 words of a single 32 byte block
+struct MembershipFilter {
+    static const int BloomBitsPerKey = 12;
+
+    /// Build from sorted @hayStack, can be called again to rebuild
+    void init(const AlignedIntArray &hayStack)
+    {
+        const int64_t count = hayStack.getCount();
+        low = hayStack[0];
+        high = hayStack[count - 1];
+        range = uint32_t(high) - uint32_t(low);
+
+        useBitmap = int64_t(range) + 1 <= count * BloomBitsPerKey * 2;
+        if (useBitmap) {
+            words.init((int64_t(range) >> 5) + 1);
+            words.memset(0);
+            for (int64_t c = 0; c < count; c++) {
+                const uint32_t bit = uint32_t(hayStack[c]) - uint32_t(low);
+                words[bit >> 5] |= 1u << (bit & 31);
+            }
+            return;
+        }
+
+        const uint64_t minBlocks = std::max<uint64_t>(2, count * BloomBitsPerKey / 256);
+        // block index comes from the top bits of a 32 bit hash
+        blockBits = std::min(31, int(std::bit_width(minBlocks - 1)));
+        words.init(int64_t(8) << blockBits);
+        words.memset(0);
+        for (int64_t c = 0; c < count; c++) {
+            const uint32_t value = hayStack[c];
+            uint32_t *block = words + int64_t(blockHash(value) >> (32 - blockBits)) * 8;
+            const uint32_t mask = maskHash(value);
+            for (int w = 0; w < 8; w++) {
+                block[w] |= 1u << ((mask * salts[w]) >> 27);
+            }
+        }
+    }
+
+    /// Check a single value
+    bool mayContain(int value) const
+    {
+        if (value < low || value > high) {
+            return false;
+        }
+        if (useBitmap) {
+            const uint32_t bit = uint32_t(value) - uint32_t(low);
+            return (words[bit >> 5] >> (bit & 31)) & 1;
+        }
+        const int64_t blockIndex = blockHash(value) >> (32 - blockBits);
+        const __m256i *block = reinterpret_cast<const __m256i *>(words + blockIndex * 8);
+        return _mm256_testc_si256(_mm256_load_si256(block), bloomMask(maskHash(value)));
+    }
+
+    /// Check 8 values at once
+    /// @return bit c is set if @values[c] may be present
+    int mayContain8(__m256i values) const
+    {
+        const __m256i relative = _mm256_sub_epi32(values, _mm256_set1_epi32(low));
+        const __m256i rangeV = _mm256_set1_epi32(int(range));
+        // unsigned relative <= range
+        const __m256i inRange = _mm256_cmpeq_epi32(_mm256_max_epu32(relative, rangeV), rangeV);
+
+        if (useBitmap) {
+            const __m256i word = _mm256_mask_i32gather_epi32(
+                _mm256_setzero_si256(),
+                reinterpret_cast<const int *>(words.get()),
+                _mm256_srli_epi32(relative, 5),
+                inRange,
+                sizeof(int));
+            const __m256i ones = _mm256_set1_epi32(1);
+            const __m256i shift = _mm256_and_si256(relative, _mm256_set1_epi32(31));
+            const __m256i bit = _mm256_and_si256(_mm256_srlv_epi32(word, shift), ones);
+            const __m256i present = _mm256_and_si256(_mm256_cmpeq_epi32(bit, ones), inRange);
+            return _mm256_movemask_ps(_mm256_castsi256_ps(present));
+        }
+
+        alignas(32) uint32_t blockIndex[8];
+        alignas(32) uint32_t masks[8];
+        const __m256i blocks =
+            _mm256_srl_epi32(blockHash8(values), _mm_cvtsi32_si128(32 - blockBits));
+        _mm256_store_si256(reinterpret_cast<__m256i *>(blockIndex), blocks);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(masks), maskHash8(values));
+
+        int result = _mm256_movemask_ps(_mm256_castsi256_ps(inRange));
+        for (int r = 0; r < 8; r++) {
+            if (result & (1 << r)) {
+                const __m256i *block =
+                    reinterpret_cast<const __m256i *>(words + int64_t(blockIndex[r]) * 8);
+                if (!_mm256_testc_si256(_mm256_load_si256(block), bloomMask(masks[r]))) {
+                    result &= ~(1 << r);
+                }
+            }
+        }
+        return result;
+    }
+
+    /// Check all @needles and set bit c of @result if needles[c] may be present
+    /// @param result - at least (needles.getCount() + 7) / 8 bytes
+    void mayContainBatch(const AlignedIntArray &needles, uint8_t *result) const
+    {
+        const int64_t needlesCount = needles.getCount();
+        int64_t c = 0;
+        for (; c + 8 <= needlesCount; c += 8) {
+            const __m256i values =
+                _mm256_load_si256(reinterpret_cast<const __m256i *>(needles.get() + c));
+            result[c >> 3] = uint8_t(mayContain8(values));
+        }
+        if (c < needlesCount) {
+            result[c >> 3] = 0;
+            for (int r = 0; c + r < needlesCount; r++) {
+                result[c >> 3] |= uint8_t(mayContain(needles[c + r]) << r);
+            }
+        }
+    }
+
+    /// Total bytes used by the filter
+    int64_t memoryBytes() const
+    {
+        return words.getCount() * sizeof(uint32_t);
+    }
+
+    bool useBitmap = false;
+    int low = 0;
+    int high = 0;
+    uint32_t range = 0;
+    int blockBits = 0;
+    AlignedArrayPtr<uint32_t> words;
+
+private:
+    static constexpr uint32_t salts[8] = {
+        0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+        0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u};
+
+    static uint32_t blockHash(uint32_t value)
+    {
+        uint32_t h = value * 0x85ebca6bu;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35u;
+        return h ^ (h >> 16);
+    }
+
+    static uint32_t maskHash(uint32_t value)
+    {
+        uint32_t h = (value ^ 0x5bd1e995u) * 0xcc9e2d51u;
+        h ^= h >> 15;
+        return h * 0x1b873593u;
+    }
+
+    static __m256i blockHash8(__m256i values)
+    {
+        __m256i h = _mm256_mullo_epi32(values, _mm256_set1_epi32(int(0x85ebca6bu)));
+        h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 13));
+        h = _mm256_mullo_epi32(h, _mm256_set1_epi32(int(0xc2b2ae35u)));
+        return _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+    }
+
+    static __m256i maskHash8(__m256i values)
+    {
+        __m256i h = _mm256_xor_si256(values, _mm256_set1_epi32(0x5bd1e995));
+        h = _mm256_mullo_epi32(h, _mm256_set1_epi32(int(0xcc9e2d51u)));
+        h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+        return _mm256_mullo_epi32(h, _mm256_set1_epi32(0x1b873593));
+    }
+
+    /// One bit per 32 bit word, selected by the top 5 bits of the salted hash
+    static __m256i bloomMask(uint32_t hash)
+    {
+        const __m256i saltsV = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(salts));
+        const __m256i salted = _mm256_mullo_epi32(_mm256_set1_epi32(int(hash)), saltsV);
+        const __m256i bits = _mm256_srli_epi32(salted, 27);
+        return _mm256_sllv_epi32(_mm256_set1_epi32(1), bits);
+    }
+};
+} // namespace
@@ -0,0 +1,279 @@
+#pragma once
+
+#include "utils.hpp"
+#include "simd-avx256.hpp"
+
+#ifndef __clang__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <utility>
+#include <vector>
+
+namespace {
+/// Table indexed by the top bits of (value - hayStack[0]) with the haystack range of each bucket
+/// The search for a value then only needs to look in [starts[bucket], starts[bucket + 1])
+struct PrefixTable {
+    static constexpr int MaxBits = 20;
+    /// Buckets are split further while the biggest one has more elements than this
+    static const int TargetMaxBucket = 64;
+
+    /// Build from sorted @hayStack, can be called again to rebuild
+    void init(const AlignedIntArray &hayStack)
+    {
+        const int64_t count = hayStack.getCount();
+        low = hayStack[0];
+        high = hayStack[count - 1];
+        range = uint32_t(high) - uint32_t(low);
+
+        // start with ~8 elements per bucket and add bits while the distribution is skewed
+        // duplicates can't be split, so stop when all bits of the range are used
+        const int rangeBits = std::bit_width(range);
+        const int maxBits = std::min(MaxBits, rangeBits);
+        // shifts stay below 32 bits
+        const int minBits = std::max(0, rangeBits - 31);
+        int bits = std::clamp(int(std::bit_width(uint64_t(count))) - 3, minBits, maxBits);
+
+        // the haystack is read once, into the runs of values in the same bucket of the finest
+        // table, coarser tables are sized by merging the runs
+        std::vector<std::pair<uint32_t, int64_t>> runs;
+        const int fineShift = rangeBits - maxBits;
+        for (int64_t c = 0; c < count;) {
+            const uint32_t fine = (uint32_t(hayStack[c]) - uint32_t(low)) >> fineShift;
+            const int64_t start = c;
+            while (c < count && (uint32_t(hayStack[c]) - uint32_t(low)) >> fineShift == fine) {
+                ++c;
+            }
+            runs.emplace_back(fine, c - start);
+        }
+
+        while (true) {
+            maxBucket = 0;
+            const int merge = maxBits - bits;
+            for (size_t r = 0; r < runs.size();) {
+                int64_t size = 0;
+                const uint32_t coarse = runs[r].first >> merge;
+                for (; r < runs.size() && runs[r].first >> merge == coarse; r++) {
+                    size += runs[r].second;
+                }
+                maxBucket = std::max(maxBucket, size);
+            }
+            if (maxBucket <= TargetMaxBucket || bits == maxBits) {
+                break;
+            }
+            bits = std::min(bits + 2, maxBits);
+        }
+
+        shift = rangeBits - bits;
+        bucketCount = (int64_t(range) >> shift) + 1;
+        starts.init(bucketCount + 1);
+        int64_t position = 0;
+        size_t r = 0;
+        for (int64_t b = 0; b < bucketCount; b++) {
+            starts[b] = position;
+            for (; r < runs.size() && int64_t(runs[r].first >> (maxBits - bits)) == b; r++) {
+                position += runs[r].second;
+            }
+        }
+        starts[bucketCount] = count;
+    }
+
+    /// Index of the bucket for @value, the value must be in [low, high]
+    int64_t bucket(int value) const
+    {
+        return (uint32_t(value) - uint32_t(low)) >> shift;
+    }
+
+    /// Search for @value in its bucket
+    /// @return index of the first @value in @hayStack or NOT_FOUND
+    int64_t find(const AlignedIntArray &hayStack, int value) const
+    {
+        if (value < low || value > high) {
+            return NOT_FOUND;
+        }
+
+        const int64_t b = bucket(value);
+        int64_t left = starts[b];
+        int64_t count = starts[b + 1] - left;
+
+        while (count > 0) {
+            const int64_t half = count / 2;
+
+            if (hayStack[left + half] < value) {
+                left = left + half + 1;
+                count -= half + 1;
+            } else {
+                count = half;
+            }
+        }
+
+        return hayStack[left] == value ? left : NOT_FOUND;
+    }
+
+    /// Total bytes used by the table
+    int64_t memoryBytes() const
+    {
+        return starts.getCount() * sizeof(int64_t);
+    }
+
+    int low = 0;
+    int high = 0;
+    uint32_t range = 0;
+    int shift = 0;
+    int64_t bucketCount = 0;
+    int64_t maxBucket = 0;
+    /// Index of the first haystack value in each bucket, with one extra entry for the end
+    AlignedArrayPtr<int64_t> starts;
+};
+
+/// Binary search that starts from the bucket of a PrefixTable instead of the whole haystack
+/// The table takes the place of the top levels of a search, a bucket is a few cache lines so the
+/// rest is a plain binary search without a bin
+/// The table is built once by init, the haystack is not copied and must outlive the index
+struct PrefixTableSearch {
+    const AlignedIntArray *hayStack = nullptr;
+    PrefixTable table;
+
+    void init(const AlignedIntArray &newHayStack)
+    {
+        hayStack = &newHayStack;
+        table.init(newHayStack);
+    }
+
+    int64_t memoryBytes() const
+    {
+        return table.memoryBytes();
+    }
+
+    void search(const AlignedIntArray &needles, AlignedIndexArray &indices, ArenaAllocator &) const
+    {
+        for (int64_t c = 0; c < needles.count; c++) {
+            indices[c] = table.find(*hayStack, needles[c]);
+        }
+    }
+};
+
+/// Same as avx256, but each lane starts from the bucket of its needle in a PrefixTable
+/// so the number of steps depends on the biggest bucket and not on the haystack size
+/// The table is built once by init, the haystack is not copied and must outlive the index
+struct Avx256PrefixTableSearch : PrefixTableSearch {
+    void search(
+        const AlignedIntArray &needles, AlignedIndexArray &indices, ArenaAllocator &allocator) const
+    {
+        // table entries are gathered as their low 32 bits
+        if (hayStack->count > INT_MAX) {
+            return PrefixTableSearch::search(needles, indices, allocator);
+        }
+
+        // with all bits of the range in the table a bucket holds copies of one value, this also
+        // covers the one bucket table of a haystack with all values the same
+        if (table.shift == 0) {
+            return searchBuckets<true, false>(needles, indices);
+        }
+        // a fixed step count predicts better while the buckets are all small
+        if (table.maxBucket > PrefixTable::TargetMaxBucket) {
+            return searchBuckets<false, true>(needles, indices);
+        }
+        searchBuckets<false, false>(needles, indices);
+    }
+
+private:
+    /// @tparam OneValueBuckets - a needle is at the start of its bucket or not in the haystack
+    /// @tparam Skewed - search each 8 needles for the steps of their biggest bucket instead of
+    /// the biggest bucket of the table
+    template <bool OneValueBuckets, bool Skewed>
+    void searchBuckets(const AlignedIntArray &needles, AlignedIndexArray &indices) const
+    {
+        const AlignedIntArray &hayStack = *this->hayStack;
+        const int64_t needlesCount = needles.count;
+
+        int64_t *indicesPtr = indices.aligned;
+        const int *haystackPtr = hayStack.aligned;
+        const int *startsPtr = reinterpret_cast<const int *>(table.starts.get());
+
+        const __m256i ones = _mm256_set1_epi32(1);
+        const __m256i neg1 = _mm256_set1_epi32(-1); // all true mask
+        const __m256i lowV = _mm256_set1_epi32(table.low);
+        const __m256i rangeV = _mm256_set1_epi32(int(table.range));
+        const __m128i shiftV = _mm_cvtsi32_si128(table.shift);
+        const int tableSteps = std::bit_width(uint64_t(table.maxBucket));
+
+        int64_t c = 0;
+        for (; c + 8 <= needlesCount; c += 8) {
+            const __m256i needle =
+                _mm256_load_si256(reinterpret_cast<const __m256i *>(needles.get() + c));
+
+            // unsigned (value - low) <= range, lanes out of range search for low and are masked
+            const __m256i relative = _mm256_sub_epi32(needle, lowV);
+            const __m256i inRange =
+                _mm256_cmpeq_epi32(_mm256_max_epu32(relative, rangeV), rangeV);
+            if (_mm256_testz_si256(inRange, inRange)) [[unlikely]] {
+                storeIndices(indicesPtr + c, neg1);
+                continue;
+            }
+            const __m256i value = _mm256_blendv_epi8(lowV, needle, inRange);
+            const __m256i bucket = _mm256_and_si256(_mm256_srl_epi32(relative, shiftV), inRange);
+
+            const __m256i startIndex = _mm256_slli_epi32(bucket, 1);
+            __m256i left = _mm256_i32gather_epi32(startsPtr, startIndex, sizeof(int));
+            const __m256i endIndex = _mm256_add_epi32(startIndex, _mm256_set1_epi32(2));
+            const __m256i right = _mm256_i32gather_epi32(startsPtr, endIndex, sizeof(int));
+
+            if constexpr (OneValueBuckets) {
+                // if (right > left) {
+                const __m256i found = _mm256_and_si256(_mm256_cmpgt_epi32(right, left), inRange);
+                storeIndices(indicesPtr + c, _mm256_blendv_epi8(neg1, left, found));
+                continue;
+            }
+
+            __m256i count = _mm256_sub_epi32(right, left);
+            int binSearchSteps = tableSteps;
+            if constexpr (Skewed) {
+                // lanes out of range search bucket 0, they take no steps
+                count = _mm256_and_si256(count, inRange);
+                __m256i maxCount =
+                    _mm256_max_epu32(count, _mm256_permute2x128_si256(count, count, 1));
+                maxCount = _mm256_max_epu32(maxCount, _mm256_shuffle_epi32(maxCount, 0x4e));
+                maxCount = _mm256_max_epu32(maxCount, _mm256_shuffle_epi32(maxCount, 0xb1));
+                binSearchSteps = std::bit_width(uint32_t(_mm256_cvtsi256_si32(maxCount)));
+            }
+
+            for (int step = 0; step < binSearchSteps; ++step) {
+                // const int half = count / 2;
+                const __m256i half = _mm256_srli_epi32(count, 1);
+
+                // const int testValue = hayStack[left + half];
+                const __m256i leftHalf = _mm256_add_epi32(left, half);
+                const __m256i testValue =
+                    _mm256_i32gather_epi32(haystackPtr, leftHalf, sizeof(int));
+
+                // if (testValue < value) {
+                const __m256i ltMask = _mm256_cmpgt_epi32(value, testValue);
+
+                // true branch
+                const __m256i lt_left = _mm256_add_epi32(leftHalf, ones);
+                const __m256i lt_count = _mm256_sub_epi32(count, _mm256_add_epi32(half, ones));
+
+                count = _mm256_blendv_epi8(half, lt_count, ltMask);
+                left = _mm256_blendv_epi8(left, lt_left, ltMask);
+            }
+
+            const __m256i haystackLeft =
+                _mm256_i32gather_epi32(haystackPtr, left, sizeof(int));
+            // if (hayStack[left] == value) {
+            const __m256i eqMask =
+                _mm256_and_si256(_mm256_cmpeq_epi32(value, haystackLeft), inRange);
+            const __m256i storeResult = _mm256_blendv_epi8(neg1, left, eqMask);
+
+            storeIndices(indicesPtr + c, storeResult);
+        }
+
+        for (; c < needlesCount; c++) {
+            indices[c] = table.find(hayStack, needles[c]);
+        }
+    }
+};
+} // namespace
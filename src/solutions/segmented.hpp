@@ -0,0 +1,269 @@
+#pragma once
+
+#include "utils.hpp"
+#include "simd-avx256.hpp"
+
+#ifndef __clang__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+
+namespace {
+/// Many small sorted arrays stored back to back in one haystack
+/// Segment s is [offsets[s], offsets[s + 1]) of @values, segments can be empty
+struct SegmentedHayStack {
+    AlignedIntArray values;
+    /// segmentCount + 1 entries, the last one is values.getCount()
+    AlignedArrayPtr<int64_t> offsets;
+    int64_t segmentCount = 0;
+    /// Size of the biggest segment, sets the number of steps of the AVX2 kernel
+    int64_t maxSegmentSize = 0;
+
+    /// Allocate @totalCount values in @newSegmentCount segments, offsets are filled by the caller
+    void init(int64_t totalCount, int64_t newSegmentCount)
+    {
+        // arrays can't be empty, but all segments can
+        values.init(std::max<int64_t>(1, totalCount));
+        values.count = totalCount;
+        offsets.init(newSegmentCount + 1);
+        segmentCount = newSegmentCount;
+    }
+
+    /// Call after the offsets are filled
+    void updateMaxSegmentSize()
+    {
+        maxSegmentSize = 0;
+        for (int64_t s = 0; s < segmentCount; s++) {
+            maxSegmentSize = std::max(maxSegmentSize, offsets[s + 1] - offsets[s]);
+        }
+    }
+};
+} // namespace
+
+/// Binary search of each needle in its own segment
+/// @param segments - segment of each needle, must be in [0, segmentCount)
+/// @param indices - index of the first needle in its segment (relative to the segment start) or -1
+static void segmentedBinarySearch(
+    const SegmentedHayStack &hayStack,
+    const AlignedIntArray &needles,
+    const AlignedIntArray &segments,
+    AlignedIndexArray &indices)
+{
+    const int *values = hayStack.values.get();
+    for (int64_t c = 0; c < needles.getCount(); c++) {
+        const int value = needles[c];
+        const int64_t start = hayStack.offsets[segments[c]];
+        const int64_t end = hayStack.offsets[segments[c] + 1];
+
+        int64_t left = start;
+        int64_t count = end - start;
+
+        while (count > 0) {
+            const int64_t half = count / 2;
+
+            if (values[left + half] < value) {
+                left = left + half + 1;
+                count -= half + 1;
+            } else {
+                count = half;
+            }
+        }
+
+        indices[c] = left < end && values[left] == value ? left - start : NOT_FOUND;
+    }
+}
+
+/// With at least this many needles per segment on average avx256Segmented groups the needles by
+/// segment, below it the counting sort costs more than the cache misses of the shared registers
+const int64_t SegmentedBucketMinNeedles = 4;
+
+namespace {
+/// Output policy of avx256Write for needles grouped by segment, each result goes back to the
+/// position of its needle in the input
+struct ScatterWriter {
+    int64_t *indicesPtr;
+    /// Position in the input of each grouped needle
+    const int *needleIndex;
+
+    void store8(int64_t c, __m256i left, __m256i eqMask)
+    {
+        alignas(32) int result[8];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(result),
+            _mm256_blendv_epi8(_mm256_set1_epi32(-1), left, eqMask));
+        for (int i = 0; i < 8; i++) {
+            indicesPtr[needleIndex[c + i]] = result[i];
+        }
+    }
+
+    void store4(int64_t c, __m256i left, __m256i eqMask)
+    {
+        alignas(32) int64_t result[4];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(result),
+            _mm256_blendv_epi8(_mm256_set1_epi64x(-1), left, eqMask));
+        for (int i = 0; i < 4; i++) {
+            indicesPtr[needleIndex[c + i]] = result[i];
+        }
+    }
+
+    void store(int64_t c, int64_t index)
+    {
+        indicesPtr[needleIndex[c]] = index;
+    }
+};
+
+/// Counting sort of the needles by segment and one avx256Write per segment, so the values of
+/// a segment stay in cache while all of its needles are searched
+/// @return false if the arena is out of memory and nothing is searched
+bool avx256SegmentedBuckets(
+    const SegmentedHayStack &hayStack,
+    const AlignedIntArray &needles,
+    const AlignedIntArray &segments,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
+{
+    const int64_t segmentCount = hayStack.segmentCount;
+    const int64_t needlesCount = needles.getCount();
+
+    const ArenaAllocator::Scope scope(allocator);
+    int64_t *segmentStart = allocator.alloc<int64_t>(segmentCount + 1);
+    int *groupedNeedles = allocator.alloc<int>(needlesCount);
+    int *needleIndex = allocator.alloc<int>(needlesCount);
+    if (!segmentStart || !groupedNeedles || !needleIndex) {
+        return false;
+    }
+
+    std::fill(segmentStart, segmentStart + segmentCount + 1, 0);
+    for (int64_t c = 0; c < needlesCount; c++) {
+        ++segmentStart[segments[c] + 1];
+    }
+    for (int64_t s = 0; s < segmentCount; s++) {
+        segmentStart[s + 1] += segmentStart[s];
+    }
+    // segmentStart[s] moves from the start to the end of the needles of segment s
+    for (int64_t c = 0; c < needlesCount; c++) {
+        const int64_t p = segmentStart[segments[c]]++;
+        groupedNeedles[p] = needles[c];
+        needleIndex[p] = int(c);
+    }
+
+    AlignedIntArray segmentHayStack;
+    AlignedIntArray segmentNeedles;
+    int64_t start = 0;
+    for (int64_t s = 0; s < segmentCount; s++) {
+        const int64_t end = segmentStart[s];
+        const int64_t size = hayStack.offsets[s + 1] - hayStack.offsets[s];
+        ScatterWriter writer{indices.aligned, needleIndex + start};
+        if (size == 0) {
+            for (int64_t p = 0; p < end - start; p++) {
+                writer.store(p, NOT_FOUND);
+            }
+        } else if (end > start) {
+            segmentHayStack.view(
+                const_cast<int *>(hayStack.values.get()) + hayStack.offsets[s], size);
+            segmentNeedles.view(groupedNeedles + start, end - start);
+            avx256Write(segmentHayStack, segmentNeedles, writer, allocator);
+        }
+        start = end;
+    }
+    return true;
+}
+} // namespace
+
+/// Same as segmentedBinarySearch with 8 needles per AVX2 register
+/// With many needles per segment they are grouped by segment and searched with avx256Write, one
+/// segment at a time. Otherwise each lane starts from the left and count of its own segment, as
+/// Avx256PrefixTableSearch does with its buckets, so needles of different segments share a
+/// register
+static void avx256Segmented(
+    const SegmentedHayStack &hayStack,
+    const AlignedIntArray &needles,
+    const AlignedIntArray &segments,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
+{
+    const int64_t totalCount = hayStack.values.getCount();
+    const int64_t needlesCount = needles.getCount();
+
+    // segments that avx256LinearScan reads whole are faster in the shared registers
+    if (totalCount > hayStack.segmentCount * LinearScanDirectCount &&
+        needlesCount >= hayStack.segmentCount * SegmentedBucketMinNeedles &&
+        needlesCount <= INT_MAX &&
+        avx256SegmentedBuckets(hayStack, needles, segments, indices, allocator)) {
+        return;
+    }
+
+    // lanes hold 32 bit indices and offsets are gathered as their low 32 bits, the offsets of
+    // segment s are ints 2 * s and 2 * s + 2
+    if (totalCount > INT_MAX || totalCount == 0 || hayStack.segmentCount >= (1 << 30)) {
+        return segmentedBinarySearch(hayStack, needles, segments, indices);
+    }
+
+    const int *valuesPtr = hayStack.values.get();
+    const int *offsetsPtr = reinterpret_cast<const int *>(hayStack.offsets.get());
+    int64_t *indicesPtr = indices.aligned;
+
+    const __m256i zeros = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi32(1);
+    const __m256i twos = _mm256_set1_epi32(2);
+    const __m256i neg1 = _mm256_set1_epi32(-1); // all true mask
+    const __m256i lastIndex = _mm256_set1_epi32(int(totalCount - 1));
+    const int binSearchSteps = std::bit_width(uint64_t(hayStack.maxSegmentSize));
+
+    int64_t c = 0;
+    for (; c + 8 <= needlesCount; c += 8) {
+        const __m256i value =
+            _mm256_load_si256(reinterpret_cast<const __m256i *>(needles.get() + c));
+        const __m256i segment =
+            _mm256_load_si256(reinterpret_cast<const __m256i *>(segments.get() + c));
+
+        const __m256i startIndex = _mm256_slli_epi32(segment, 1);
+        const __m256i start = _mm256_i32gather_epi32(offsetsPtr, startIndex, sizeof(int));
+        const __m256i end =
+            _mm256_i32gather_epi32(offsetsPtr, _mm256_add_epi32(startIndex, twos), sizeof(int));
+        __m256i left = start;
+        __m256i count = _mm256_sub_epi32(end, start);
+
+        for (int step = 0; step < binSearchSteps; ++step) {
+            // const int half = count / 2;
+            const __m256i half = _mm256_srli_epi32(count, 1);
+
+            // const int testValue = hayStack[left + half];
+            // lanes of smaller segments are done and may point one past the end of the haystack
+            const __m256i leftHalf = _mm256_add_epi32(left, half);
+            const __m256i testValue = _mm256_i32gather_epi32(
+                valuesPtr, _mm256_min_epi32(leftHalf, lastIndex), sizeof(int));
+
+            // if (count > 0 && testValue < value) {
+            const __m256i ltMask = _mm256_and_si256(
+                _mm256_cmpgt_epi32(value, testValue), _mm256_cmpgt_epi32(count, zeros));
+
+            // true branch
+            const __m256i lt_left = _mm256_add_epi32(leftHalf, ones);
+            const __m256i lt_count = _mm256_sub_epi32(count, _mm256_add_epi32(half, ones));
+
+            count = _mm256_blendv_epi8(half, lt_count, ltMask);
+            left = _mm256_blendv_epi8(left, lt_left, ltMask);
+        }
+
+        const __m256i valuesLeft =
+            _mm256_i32gather_epi32(valuesPtr, _mm256_min_epi32(left, lastIndex), sizeof(int));
+        // if (left < end && hayStack[left] == value) {
+        const __m256i eqMask = _mm256_and_si256(
+            _mm256_cmpeq_epi32(value, valuesLeft), _mm256_cmpgt_epi32(end, left));
+        const __m256i storeResult =
+            _mm256_blendv_epi8(neg1, _mm256_sub_epi32(left, start), eqMask);
+
+        storeIndices(indicesPtr + c, storeResult);
+    }
+
+    for (; c < needlesCount; c++) {
+        const int value = needles[c];
+        const int64_t start = hayStack.offsets[segments[c]];
+        const int64_t end = hayStack.offsets[segments[c] + 1];
+        const int *pos = std::lower_bound(valuesPtr + start, valuesPtr + end, value);
+        indices[c] = pos != valuesPtr + end && *pos == value ? pos - valuesPtr - start : NOT_FOUND;
+    }
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include "utils.hpp"
+#include "parallel.hpp"
+#include "baseline.hpp"
+#include "simd-avx256.hpp"
+#include "tiled.hpp"
+
+#include <algorithm>
+#include <climits>
+
+/// Haystack bytes per shard, a shard is searched by one thread and should stay in its L2
+const int64_t ShardBytes = 1 << 20;
+/// Smaller batches are searched on the calling thread, spawning threads costs more
+const int64_t ShardedMinNeedles = 1 << 14;
+
+namespace {
+/// Each thread searches a contiguous slice of the needles in the whole haystack
+template <bool UseSIMD>
+void needlePartitionedSearch(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
+{
+    const bool parallel = needles.count >= ShardedMinNeedles;
+    parallelFor(needles.count, [&](int64_t begin, int64_t end) {
+        AlignedIntArray needleSlice;
+        AlignedIndexArray indexSlice;
+        needleSlice.view(const_cast<int *>(needles.get()) + begin, end - begin);
+        indexSlice.view(indices.get() + begin, end - begin);
+        if (UseSIMD && parallel) {
+            // the arena is not thread safe, the workers lease their own
+            const ArenaPool::Lease lease(workerArenas());
+            avx256(hayStack, needleSlice, indexSlice, lease.arena);
+        } else if (UseSIMD) {
+            avx256(hayStack, needleSlice, indexSlice, allocator);
+        } else {
+            binarySearch(hayStack, needleSlice, indexSlice);
+        }
+    }, parallel ? 0 : 1);
+}
+
+/// Split the haystack in ranges of ShardBytes, route every needle to the shard that holds its
+/// lower bound and let each thread search the needles of its own contiguous group of shards
+/// Routing is a counting sort of (needle, index) pairs by shard done in parallel over needle
+/// chunks, a needle goes to the last shard whose first value is less than it, so its lower bound
+/// is at most the first index of the next shard and positions in the shard are global indices
+template <bool UseSIMD>
+void shardedSearch(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
+{
+    const int64_t haystackCount = hayStack.count;
+    const int64_t needlesCount = needles.count;
+    const int lowCut = hayStack[0];
+    const int highCut = hayStack[haystackCount - 1];
+
+    // items keep the needle index in 32 bits and avx256Tile keeps haystack indices in 32 bits
+    if (needlesCount > INT_MAX || haystackCount > INT_MAX) {
+        return needlePartitionedSearch<false>(hayStack, needles, indices, allocator);
+    }
+
+    const int threads = needlesCount >= ShardedMinNeedles ? hardwareThreads() : 1;
+    const int64_t shardSize = ShardBytes / sizeof(int);
+    const int shardCount = int(std::min<int64_t>(
+        haystackCount, std::max<int64_t>(threads, (haystackCount + shardSize - 1) / shardSize)));
+    const int chunkCount = threads;
+
+    const ArenaAllocator::Scope scope(allocator);
+    int64_t *shardStart = allocator.alloc<int64_t>(shardCount + 1);
+    int *splitters = allocator.alloc<int>(shardCount);
+    int64_t *chunkShardStart = allocator.alloc<int64_t>(int64_t(chunkCount) * shardCount);
+    int64_t *shardItemStart = allocator.alloc<int64_t>(shardCount + 1);
+    int *needleShard = allocator.alloc<int>(needlesCount);
+    int *items = allocator.alloc<int>(needlesCount * 2);
+    if (!shardStart || !splitters || !chunkShardStart || !shardItemStart || !needleShard ||
+        !items) {
+        return needlePartitionedSearch<false>(hayStack, needles, indices, allocator);
+    }
+
+    for (int s = 0; s <= shardCount; s++) {
+        shardStart[s] = haystackCount * s / shardCount;
+    }
+    for (int s = 0; s < shardCount; s++) {
+        splitters[s] = hayStack[shardStart[s]];
+    }
+    memset(chunkShardStart, 0, sizeof(int64_t) * chunkCount * shardCount);
+
+    // route every needle and count the needles per (chunk, shard)
+    parallelFor(chunkCount, [&](int64_t firstChunk, int64_t lastChunk) {
+        for (int64_t k = firstChunk; k < lastChunk; k++) {
+            int64_t *counts = chunkShardStart + k * shardCount;
+            const int64_t chunkEnd = needlesCount * (k + 1) / chunkCount;
+            for (int64_t c = needlesCount * k / chunkCount; c < chunkEnd; c++) {
+                const int value = needles[c];
+                if (value < lowCut || value > highCut) {
+                    indices[c] = NOT_FOUND;
+                    needleShard[c] = -1;
+                    continue;
+                }
+                // splitters[0] is never above the needle, only the rest decide the shard
+                needleShard[c] =
+                    int(std::lower_bound(splitters + 1, splitters + shardCount, value) - splitters)
+                    - 1;
+                ++counts[needleShard[c]];
+            }
+        }
+    }, chunkCount);
+
+    // items are ordered by shard, then by chunk, so each chunk scatters to its own positions
+    int64_t position = 0;
+    for (int s = 0; s < shardCount; s++) {
+        shardItemStart[s] = position;
+        for (int k = 0; k < chunkCount; k++) {
+            const int64_t count = chunkShardStart[int64_t(k) * shardCount + s];
+            chunkShardStart[int64_t(k) * shardCount + s] = position;
+            position += count;
+        }
+    }
+    shardItemStart[shardCount] = position;
+
+    parallelFor(chunkCount, [&](int64_t firstChunk, int64_t lastChunk) {
+        for (int64_t k = firstChunk; k < lastChunk; k++) {
+            int64_t *positions = chunkShardStart + k * shardCount;
+            const int64_t chunkEnd = needlesCount * (k + 1) / chunkCount;
+            for (int64_t c = needlesCount * k / chunkCount; c < chunkEnd; c++) {
+                if (needleShard[c] != -1) {
+                    const int64_t p = positions[needleShard[c]]++;
+                    items[p * 2] = needles[c];
+                    items[p * 2 + 1] = int(c);
+                }
+            }
+        }
+    }, chunkCount);
+
+    // every thread owns a contiguous range of the haystack
+    parallelFor(shardCount, [&](int64_t firstShard, int64_t lastShard) {
+        for (int64_t s = firstShard; s < lastShard; s++) {
+            const int64_t begin = shardItemStart[s];
+            const int64_t end = shardItemStart[s + 1];
+            const int64_t shardLeft = shardStart[s];
+            const int64_t shardLength = shardStart[s + 1] - shardLeft;
+
+            int64_t c = begin;
+            if (UseSIMD) {
+                c += avx256Tile(hayStack.aligned, shardLeft, shardLength, items + begin * 2,
+                    end - begin, indices.aligned);
+            }
+
+            for (; c < end; c++) {
+                const int value = items[c * 2];
+                int64_t left = shardLeft;
+                int64_t count = shardLength;
+
+                while (count > 0) {
+                    const int64_t half = count / 2;
+
+                    if (hayStack[left + half] < value) {
+                        left = left + half + 1;
+                        count -= half + 1;
+                    } else {
+                        count = half;
+                    }
+                }
+
+                indices[items[c * 2 + 1]] = hayStack[left] == value ? left : NOT_FOUND;
+            }
+        }
+    }, threads);
+}
+} // namespace
+
+/// Baseline of the sharded search, binarySearch on one slice of the needles per thread
+static void parallelBinarySearch(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
+{
+    needlePartitionedSearch<false>(hayStack, needles, indices, allocator);
+}
+
+/// Baseline of the sharded search, avx256 on one slice of the needles per thread
+static void parallelAvx256(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
+{
+    needlePartitionedSearch<true>(hayStack, needles, indices, allocator);
+}
+
+/// Binary search with the haystack range sharded across threads
+static void binarySearchSharded(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
+{
+    shardedSearch<false>(hayStack, needles, indices, allocator);
+}
+
+/// AVX2 search with the haystack range sharded across threads, all lanes of a shard start from
+/// the same range as in avx256Tiled
+static void avx256Sharded(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
+{
+    shardedSearch<true>(hayStack, needles, indices, allocator);
+}
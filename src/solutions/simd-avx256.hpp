@@ -1,12 +1,24 @@
 #pragma once
 
 #include "utils.hpp"
+#include "parallel.hpp"
+#include "prefilter.hpp"
+#include "linear-scan.hpp"
+#include "output-writers.hpp"
+#include "search-stats.hpp"
 
 #ifndef __clang__
 #include <immintrin.h>
 #endif
 
 #include <algorithm>
+#include <bit>
+#include <climits>
+#include <type_traits>
+#include <utility>
+
+/// Most steps of a search over 32 bit indices, std::bit_width(INT_MAX)
+const int EytzingerMaxSteps = 31;
 
 namespace {
 inline __m256i masked_blend(__m256i a, __m256i b, __m256i mask)
@@ -15,38 +27,100 @@ inline __m256i masked_blend(__m256i a, __m256i b, __m256i mask)
         _mm256_castsi256_ps(b), _mm256_castsi256_ps(a), _mm256_castsi256_ps(mask)));
 }
 
+/// Top @BinSteps steps of the search of 8 needles, read from the bin and unrolled
+/// The haystack must have at least (1 << BinSteps) - 1 values, no range gets empty before the
+/// last bin step
+/// @param left [in/out] - first index of the range left to search in each lane
+/// @param count [in/out] - size of the range left to search in each lane
+template <int BinSteps>
+__attribute__((always_inline)) inline void eytzingerBinStepsSIMD(
+    const int *bin, __m256i value, __m256i &left, __m256i &count)
+{
+    const __m256i ones = _mm256_set1_epi32(1);
+    __m256i binIndex = ones;
+#pragma GCC unroll 32
+    for (int step = 0; step < BinSteps; ++step) {
+        const __m256i half = _mm256_srli_epi32(count, 1);
+        const __m256i testValue = _mm256_i32gather_epi32(bin, binIndex, sizeof(int));
+        // if (testValue < value) {
+        const __m256i ltMask = _mm256_cmpgt_epi32(value, testValue);
+        const __m256i halfOne = _mm256_add_epi32(half, ones);
+        left = masked_blend(_mm256_add_epi32(left, halfOne), left, ltMask);
+        count = masked_blend(_mm256_sub_epi32(count, halfOne), half, ltMask);
+        // binIndex * 2 + 1 when less, the mask is -1
+        binIndex = _mm256_sub_epi32(_mm256_slli_epi32(binIndex, 1), ltMask);
+    }
+}
+
+/// Last @HaystackSteps steps of the search of 8 needles, read from the haystack and unrolled
+template <int HaystackSteps>
+__attribute__((always_inline)) inline void eytzingerHaystackStepsSIMD(
+    const int *hayStack, __m256i value, __m256i &left, __m256i &count)
+{
+    const __m256i ones = _mm256_set1_epi32(1);
+#pragma GCC unroll 32
+    for (int step = 0; step < HaystackSteps; ++step) {
+        const __m256i half = _mm256_srli_epi32(count, 1);
+        const __m256i leftHalf = _mm256_add_epi32(left, half);
+        const __m256i testValue = _mm256_i32gather_epi32(hayStack, leftHalf, sizeof(int));
+        // if (testValue < value) {
+        const __m256i ltMask = _mm256_cmpgt_epi32(value, testValue);
+        const __m256i halfOne = _mm256_add_epi32(half, ones);
+        left = masked_blend(_mm256_add_epi32(left, halfOne), left, ltMask);
+        count = masked_blend(_mm256_sub_epi32(count, halfOne), half, ltMask);
+    }
+}
+
+/// Call @kernel with std::integral_constant<int, HaystackSteps>, the steps of a search of a
+/// haystack of @haystackCount values that are left after @BinSteps steps in the bin
+/// Each haystack size class gets its own instantiation of the kernel with all steps unrolled
+/// @param haystackCount - in [(1 << BinSteps) - 1, INT_MAX]
+template <int BinSteps, typename Kernel>
+inline void dispatchHaystackSteps(int64_t haystackCount, Kernel &&kernel)
+{
+    const int haystackSteps = int(std::bit_width(uint64_t(haystackCount))) - BinSteps;
+    [&]<int... S>(std::integer_sequence<int, S...>) {
+        ((haystackSteps == S && (kernel(std::integral_constant<int, S>{}), true)) || ...);
+    }(std::make_integer_sequence<int, EytzingerMaxSteps - BinSteps + 1>{});
+}
+
+/// @param mayContain - optional, needles with their bit cleared are not searched
+template <typename Stats, typename Writer>
 static void serialFinishSIMDEytzinger(
-    int c,
-    int needlesCount,
+    int64_t c,
+    int64_t needlesCount,
     int stepCount,
     const int *bin,
     const AlignedIntArray &hayStack,
     const AlignedIntArray &needles,
-    AlignedIntArray &indices)
+    Writer &writer,
+    const uint8_t *mayContain = nullptr)
 {
     const int lowCut = hayStack[0];
-    const int haystackCount = hayStack.getCount() - 1;
-    const int highCut = hayStack[haystackCount];
+    // the bin is built for the whole haystack, so the search must split it the same way
+    const int64_t haystackCount = hayStack.getCount();
+    const int highCut = hayStack[haystackCount - 1];
 
     for (; c < needlesCount; c++) {
         const int value = needles[c];
         if (value < lowCut || value > highCut) {
-            indices[c] = NOT_FOUND;
+            writer.store(c, NOT_FOUND);
+            Stats::rangeRejects(1);
+            continue;
+        }
+        if (mayContain && !((mayContain[c >> 3] >> (c & 7)) & 1)) {
+            writer.store(c, NOT_FOUND);
+            Stats::filterRejects(1);
             continue;
         }
 
-        int left = 0;
-        int count = haystackCount;
+        int64_t left = 0;
+        int64_t count = haystackCount;
         int binIdx = 1;
-        int step = 0;
-
-        while (count > 0) {
-            const int half = count / 2;
-
-            const int testValue = step < stepCount ? bin[binIdx] : hayStack[left + half];
-            ++step;
-
-            if (testValue < value) {
+        int binSteps = 0;
+        for (; binSteps < stepCount && count > 0; ++binSteps) {
+            const int64_t half = count / 2;
+            if (bin[binIdx] < value) {
                 left = left + half + 1;
                 count -= half + 1;
                 binIdx = binIdx * 2 + 1;
@@ -56,38 +130,49 @@ static void serialFinishSIMDEytzinger(
             }
         }
 
-        if (hayStack[left] == value) {
-            indices[c] = left;
-        } else {
-            indices[c] = NOT_FOUND;
+        int haystackSteps = 0;
+        while (count > 0) {
+            const int64_t half = count / 2;
+            ++haystackSteps;
+            if (hayStack[left + half] < value) {
+                left = left + half + 1;
+                count -= half + 1;
+            } else {
+                count = half;
+            }
         }
+        Stats::serialNeedles(1);
+        Stats::steps(binSteps, haystackSteps, 1);
+
+        writer.store(c, hayStack[left] == value ? left : NOT_FOUND);
     }
 }
 
+template <typename Writer>
 inline void serialFinishSIMD(
-    int c,
-    int needlesCount,
+    int64_t c,
+    int64_t needlesCount,
     const AlignedIntArray &hayStack,
     const AlignedIntArray &needles,
-    AlignedIntArray &indices)
+    Writer &writer)
 {
     const int lowCut = hayStack[0];
-    const int haystackCount = hayStack.getCount() - 1;
+    const int64_t haystackCount = hayStack.getCount() - 1;
     const int highCut = hayStack[haystackCount];
 
     for (; c < needlesCount; c++) {
         const int value = needles[c];
         if (value < lowCut || value > highCut) {
-            indices[c] = NOT_FOUND;
+            writer.store(c, NOT_FOUND);
             continue;
         }
 
-        int left = 0;
-        int count = haystackCount;
+        int64_t left = 0;
+        int64_t count = haystackCount;
         int binIdx = 1;
 
         while (count > 0) {
-            const int half = count / 2;
+            const int64_t half = count / 2;
 
             const int testValue = hayStack[left + half];
 
@@ -101,77 +186,134 @@ inline void serialFinishSIMD(
             }
         }
 
-        if (hayStack[left] == value) {
-            indices[c] = left;
-        } else {
-            indices[c] = NOT_FOUND;
+        writer.store(c, hayStack[left] == value ? left : NOT_FOUND);
+    }
+}
+
+/// Same as the avx256 loop but with 4 lanes of 64 bit indices, for haystacks over 2^31 elements
+/// @return the index of the first needle that is not searched yet
+template <typename Writer>
+int64_t avx256Wide(const AlignedIntArray &hayStack, const AlignedIntArray &needles, Writer &writer)
+{
+    const int64_t haystackCount = hayStack.count;
+    const int64_t needlesCount = needles.count;
+    const int *haystackPtr = hayStack.aligned;
+
+    const __m256i zeros = _mm256_set1_epi64x(0);
+    const __m256i ones = _mm256_set1_epi64x(1);
+    const __m256i haystackCountV = _mm256_set1_epi64x(haystackCount);
+    const int binSearchSteps = int(log2(haystackCount)) + 1;
+
+    int64_t c = 0;
+    for (; c + 4 < needlesCount; c += 4) {
+        const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(needles.get() + c));
+        __m256i left = zeros;
+        __m256i count = haystackCountV;
+
+        for (int step = 0; step < binSearchSteps; ++step) {
+            // const int64_t half = count / 2;
+            const __m256i half = _mm256_srli_epi64(count, 1);
+
+            // const int testValue = hayStack[left + half];
+            const __m256i leftHalf = _mm256_add_epi64(left, half);
+            const __m128i testValue = _mm256_i64gather_epi32(haystackPtr, leftHalf, sizeof(int));
+
+            // if (testValue < value) {, the 32 bit mask widened to the 64 bit lanes
+            const __m256i ltMask = _mm256_cvtepi32_epi64(_mm_cmpgt_epi32(value, testValue));
+
+            // true branch
+            const __m256i lt_left = _mm256_add_epi64(leftHalf, ones);
+            const __m256i lt_count = _mm256_sub_epi64(count, _mm256_add_epi64(half, ones));
+
+            count = _mm256_blendv_epi8(half, lt_count, ltMask);
+            left = _mm256_blendv_epi8(left, lt_left, ltMask);
         }
+
+        const __m128i haystackLeft = _mm256_i64gather_epi32(haystackPtr, left, sizeof(int));
+        // if (hayStack[left] == value) {
+        const __m256i eqMask = _mm256_cvtepi32_epi64(_mm_cmpeq_epi32(value, haystackLeft));
+
+        writer.store4(c, left, eqMask);
     }
+    return c;
+}
+
+/// avx256Wide and the serial finish, the Eytzinger kernels use it for haystacks their 32 bit bin
+/// and lanes cannot index
+template <typename Writer>
+void avx256WideSearch(const AlignedIntArray &hayStack, const AlignedIntArray &needles, Writer &writer)
+{
+    const int64_t c = needles.count > 1024 ? avx256Wide(hayStack, needles, writer) : 0;
+    serialFinishSIMD(c, needles.count, hayStack, needles, writer);
 }
 } // namespace
 
-template <int BinStepCount, int SortSimdBatchCount>
-static void avx256EytzingerRangeCheck(
+/// The avx256EytzingerRangeCheck traversal with the results passed to @writer
+/// Needles leave the sorted queue in no particular order, so each result goes to writer.store
+/// @param bin - top @stepCount levels of the search as built by precomputeBin, 1 based
+/// @param stepCount - levels in @bin, the SIMD loop runs only with all BinStepCount of them
+/// @param filter - optional, needles it rejects are not queued
+/// @tparam Stats - NoStats or SearchStats to count where the needles and cycles go
+template <int BinStepCount, int SortSimdBatchCount, typename Stats, typename Writer>
+static void avx256EytzingerRangeCheckTraversal(
     const AlignedIntArray &hayStack,
     const AlignedIntArray &needles,
-    AlignedIntArray &indices,
-    StackAllocator &allocator)
+    Writer &writer,
+    ArenaAllocator &allocator,
+    const int *bin,
+    int stepCount,
+    const MembershipFilter *filter = nullptr)
 {
-    const int haystackCount = int(hayStack.count);
-    const int needlesCount = int(needles.count);
+    const int64_t haystackCount = hayStack.count;
+    const int64_t needlesCount = needles.count;
     const int lowCut = hayStack[0];
     const int highCut = hayStack[haystackCount - 1];
 
-    if (lowCut == highCut) {
-        const int resultIndex = lowCut == needles[0] ? 0 : NOT_FOUND;
-        for (int c = 0; c < indices.count; c++) {
-            indices[c] = resultIndex;
-        }
-        return;
-    }
-
-    const bool useSIMD = (haystackCount > (1024 * 100)) && (needlesCount > 1024);
-    const int stepCount = useSIMD ? BinStepCount : 0;
-    int *indicesPtr = indices.aligned;
+    // the unrolled bin steps need a full bin, lanes and queue items hold 32 bit indices
+    const bool useSIMD =
+        needlesCount > 1024 && stepCount == BinStepCount && haystackCount <= INT_MAX;
     const int *haystackPtr = hayStack.aligned;
 
-    int *bin = nullptr;
-    if (useSIMD) {
-        const int binSize = 1 << stepCount;
-        bin = allocator.alloc<int>(binSize + 1);
-        precomputeBin(haystackPtr, haystackCount, bin, stepCount);
+    // bit c is set when needles[c] may be in the haystack
+    const ArenaAllocator::Scope scope(allocator);
+    uint8_t *mayContain = nullptr;
+    if (filter && useSIMD) {
+        mayContain = allocator.alloc<uint8_t>((needlesCount + 7) / 8);
+        filter->mayContainBatch(needles, mayContain);
     }
 
-    int c = 0;
+    int64_t c = 0;
 
-    const __m256i zeros = _mm256_set1_epi32(0);
-    const __m256i ones = _mm256_set1_epi32(1);
-    const __m256i neg1 = _mm256_set1_epi32(-1); // all true mask
-    const __m256i haystackCountV = _mm256_set1_epi32(haystackCount);
-
-    const int binSearchSteps = int(log2(haystackCount)) + 1;
-
-    if (useSIMD) {
+    // index is relative to the start of the batch to keep items 8 bytes
+    struct Item {
+        int needle;
+        int index;
+    };
+    const int sortQueSize = SortSimdBatchCount * 8;
 
-        struct Item {
-            int needle;
-            int index;
-        };
-        const int sortQueSize = SortSimdBatchCount * 8;
+    auto simdLoop = [&](auto haystackSteps) {
+        constexpr int HaystackSteps = decltype(haystackSteps)::value;
+        const __m256i zeros = _mm256_set1_epi32(0);
+        const __m256i neg1 = _mm256_set1_epi32(-1); // all true mask
+        const __m256i haystackCountV = _mm256_set1_epi32(int(haystackCount));
         alignas(32) Item queue[sortQueSize];
 
         while (c + sortQueSize < needlesCount) {
-            int saved = c;
+            const int64_t saved = c;
             int q = 0;
+            int64_t rangeRejected = 0;
 
-            while (q < sortQueSize && c < needlesCount) {
+            while (q < sortQueSize && c < needlesCount && c - saved < INT_MAX) {
                 const int candidate = needles[c];
-                if (candidate >= lowCut && candidate <= highCut) {
+                const bool mayBeFound = !mayContain || ((mayContain[c >> 3] >> (c & 7)) & 1);
+                const bool inRange = candidate >= lowCut && candidate <= highCut;
+                if (inRange && mayBeFound) {
                     queue[q].needle = candidate;
-                    queue[q].index = c;
+                    queue[q].index = int(c - saved);
                     q++;
                 } else {
-                    indices[c] = NOT_FOUND;
+                    writer.store(c, NOT_FOUND);
+                    rangeRejected += !inRange;
                 }
                 c++;
             }
@@ -180,10 +322,14 @@ static void avx256EytzingerRangeCheck(
                 c = saved;
                 break;
             }
+            Stats::rangeRejects(rangeRejected);
+            Stats::filterRejects(c - saved - q - rangeRejected);
 
+            const uint64_t sortStart = Stats::now();
             std::sort(queue, queue + sortQueSize, [](const Item &a, const Item &b) {
                 return a.needle < b.needle;
             });
+            Stats::sortCycles(Stats::now() - sortStart);
 
             for (int chunk = 0; chunk < SortSimdBatchCount; chunk++) {
                 const __m256i value = _mm256_i32gather_epi32(
@@ -192,244 +338,389 @@ static void avx256EytzingerRangeCheck(
                     4);
                 __m256i left = zeros;
                 __m256i count = haystackCountV;
-                __m256i binIndex = ones;
-                int step = 0;
-
-                for (; step < stepCount; ++step) {
-                    // const int half = count / 2;
-                    const __m256i half = _mm256_srli_epi32(count, 1);
-
-                    // const int testValue = step < stepCount ? bin[binIdx] :
-                    // hayStack[left + half];
-                    const __m256i leftHalf = _mm256_add_epi32(left, half);
-                    const __m256i testValue = _mm256_i32gather_epi32(bin, binIndex, sizeof(int));
-
-                    // if (testValue < value) {
-                    const __m256i gt = _mm256_cmpgt_epi32(testValue, value);
-                    const __m256i eq = _mm256_cmpeq_epi32(testValue, value);
-                    const __m256i ltMask = _mm256_andnot_si256(
-                        _mm256_castps_si256(
-                            _mm256_or_ps(_mm256_castsi256_ps(gt), _mm256_castsi256_ps(eq))),
-                        neg1);
-
-                    // true branch
-                    const __m256i lt_left = _mm256_add_epi32(leftHalf, ones);
-                    const __m256i lt_count = _mm256_sub_epi32(count, _mm256_add_epi32(half, ones));
-                    const __m256i lt_binIdx =
-                        _mm256_add_epi32(_mm256_slli_epi32(binIndex, 1), ones);
-
-                    // false branch
-                    const __m256i gt_eq_binIndex = _mm256_slli_epi32(binIndex, 1);
-
-                    // mix with result
-                    binIndex = masked_blend(lt_binIdx, gt_eq_binIndex, ltMask);
-                    count = masked_blend(lt_count, half, ltMask);
-                    left = masked_blend(lt_left, left, ltMask);
-                }
-
-                for (; step < binSearchSteps; ++step) {
-                    // const int half = count / 2;
-                    const __m256i half = _mm256_srli_epi32(count, 1);
-
-                    // const int testValue = step < stepCount ? bin[binIdx] :
-                    // hayStack[left + half];
-                    const __m256i leftHalf = _mm256_add_epi32(left, half);
-                    const __m256i testValue =
-                        _mm256_i32gather_epi32(haystackPtr, leftHalf, sizeof(int));
-
-                    // if (testValue < value) {
-                    const __m256i gt = _mm256_cmpgt_epi32(testValue, value);
-                    const __m256i eq = _mm256_cmpeq_epi32(testValue, value);
-                    const __m256i ltMask = _mm256_andnot_si256(
-                        _mm256_castps_si256(
-                            _mm256_or_ps(_mm256_castsi256_ps(gt), _mm256_castsi256_ps(eq))),
-                        neg1);
-
-                    // true branch
-                    const __m256i lt_left = _mm256_add_epi32(leftHalf, ones);
-                    const __m256i lt_count = _mm256_sub_epi32(count, _mm256_add_epi32(half, ones));
-                    const __m256i lt_binIdx =
-                        _mm256_add_epi32(_mm256_slli_epi32(binIndex, 1), ones);
-
-                    // false branch
-                    const __m256i gt_eq_binIndex = _mm256_slli_epi32(binIndex, 1);
-
-                    // mix with result
-                    binIndex = masked_blend(lt_binIdx, gt_eq_binIndex, ltMask);
-                    count = masked_blend(lt_count, half, ltMask);
-                    left = masked_blend(lt_left, left, ltMask);
-                }
+                eytzingerBinStepsSIMD<BinStepCount>(bin, value, left, count);
+                eytzingerHaystackStepsSIMD<HaystackSteps>(haystackPtr, value, left, count);
 
                 const __m256i haystackLeft = _mm256_i32gather_epi32(haystackPtr, left, sizeof(int));
                 // if (hayStack[left] == value) {
                 const __m256i eqMask = _mm256_cmpeq_epi32(value, haystackLeft);
                 const __m256i storeResult = masked_blend(left, neg1, eqMask);
 
+                Stats::simdNeedles(8);
+                Stats::steps(BinStepCount, HaystackSteps, 8);
+
                 // search values are not consecutive, scatter according to their
                 // indices there is no scatter_epi32 in AVX/AVX2
+                const uint64_t scatterStart = Stats::now();
                 alignas(32) int writeBack[8];
                 _mm256_store_si256(reinterpret_cast<__m256i *>(writeBack), storeResult);
                 for (int r = 0; r < 8; r++) {
-                    indicesPtr[queue[r + 8 * chunk].index] = writeBack[r];
+                    writer.store(saved + queue[r + 8 * chunk].index, writeBack[r]);
                 }
+                Stats::scatterCycles(Stats::now() - scatterStart);
             }
         }
+    };
+    if (useSIMD) {
+        dispatchHaystackSteps<BinStepCount>(haystackCount, simdLoop);
     }
 
-    serialFinishSIMDEytzinger(c, needlesCount, stepCount, bin, hayStack, needles, indices);
-
-    allocator.freeAll();
+    serialFinishSIMDEytzinger<Stats>(
+        c, needlesCount, stepCount, bin, hayStack, needles, writer, mayContain);
 }
 
-template <int BinStepCount>
-static void avx256Eytzinger(
+/// avx256EytzingerRangeCheck with a bin built by the caller and the results passed to @writer
+/// Haystacks of one value, small haystacks and haystacks over INT_MAX are searched without
+/// the traversal
+/// @param bin - top @stepCount levels of the search as built by precomputeBin, 1 based
+/// @param stepCount - levels in @bin, the SIMD loop runs only with all BinStepCount of them
+/// @param filter - optional, needles it rejects are not queued
+/// @tparam Stats - NoStats or SearchStats to count where the needles and cycles go
+template <int BinStepCount, int SortSimdBatchCount, typename Stats, typename Writer>
+static void avx256EytzingerRangeCheckBinWrite(
     const AlignedIntArray &hayStack,
     const AlignedIntArray &needles,
-    AlignedIntArray &indices,
-    StackAllocator &allocator)
+    Writer &writer,
+    ArenaAllocator &allocator,
+    const int *bin,
+    int stepCount,
+    const MembershipFilter *filter = nullptr)
 {
-    const int haystackCount = int(hayStack.count);
-    const int needlesCount = int(needles.count);
-
-    const bool useSIMD = (haystackCount > (1024 * 100)) && (needlesCount > 1024);
-    const int stepCount = useSIMD ? BinStepCount : 0;
-    int *indicesPtr = indices.aligned;
-    const int *haystackPtr = hayStack.aligned;
+    const int64_t haystackCount = hayStack.count;
+    const int64_t needlesCount = needles.count;
+    const int lowCut = hayStack[0];
 
-    int *bin = nullptr;
-    if (useSIMD) {
-        const int binSize = 1 << stepCount;
-        bin = allocator.alloc<int>(binSize + 1);
-        precomputeBin(haystackPtr, haystackCount, bin, stepCount);
+    if (lowCut == hayStack[haystackCount - 1]) {
+        Stats::shortcutNeedles(needlesCount);
+        const __m256i lowCutV = _mm256_set1_epi32(lowCut);
+        int64_t c = 0;
+        for (; c + 8 <= needlesCount; c += 8) {
+            const __m256i value =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(needles.get() + c));
+            writer.store8(c, _mm256_setzero_si256(), _mm256_cmpeq_epi32(value, lowCutV));
+        }
+        for (; c < needlesCount; c++) {
+            writer.store(c, needles[c] == lowCut ? 0 : NOT_FOUND);
+        }
+        return;
     }
 
-    int c = 0;
-
-    const __m256i zeros = _mm256_set1_epi32(0);
-    const __m256i ones = _mm256_set1_epi32(1);
-    const __m256i neg1 = _mm256_set1_epi32(-1); // all true mask
-    const __m256i haystackCountV = _mm256_set1_epi32(haystackCount);
-
-    if (useSIMD) {
-        alignas(32) int needleQueue[8];
-        const int binSearchSteps = int(log2(haystackCount)) + 1;
+    if (haystackCount <= LinearScanMaxCount) {
+        Stats::shortcutNeedles(needlesCount);
+        return avx256LinearScanWrite(hayStack, needles, writer, allocator);
+    }
 
-        while (c + 8 < needlesCount) {
-            memcpy(needleQueue, needles.get() + c, 8 * sizeof(needles[0]));
+    // lanes and queue items hold 32 bit indices
+    if (haystackCount > INT_MAX) {
+        Stats::shortcutNeedles(needlesCount);
+        return avx256WideSearch(hayStack, needles, writer);
+    }
 
-            const __m256i value =
-                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(needleQueue));
-            __m256i left = zeros;
-            __m256i count = haystackCountV;
-            __m256i binIndex = ones;
+    avx256EytzingerRangeCheckTraversal<BinStepCount, SortSimdBatchCount, Stats>(
+        hayStack, needles, writer, allocator, bin, stepCount, filter);
+}
 
-            int step = 0;
+/// avx256EytzingerRangeCheck with a bin built per call and the results passed to @writer, the
+/// index, bitmap and count modes all go through it
+/// @tparam Stats - NoStats or SearchStats to count where the needles and cycles go
+template <int BinStepCount, int SortSimdBatchCount, typename Stats, typename Writer>
+static void avx256EytzingerRangeCheckWrite(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    Writer &writer,
+    ArenaAllocator &allocator)
+{
+    // the bin is only read by the SIMD loop and its serial finish
+    const bool useBin = needles.count > 1024 && hayStack.count > LinearScanMaxCount &&
+        hayStack.count <= INT_MAX && hayStack.count >= (1 << BinStepCount) - 1;
+    const int stepCount = useBin ? BinStepCount : 0;
 
-            for (; step < stepCount; ++step) {
-                // const int half = count / 2;
-                const __m256i half = _mm256_srli_epi32(count, 1);
+    const ArenaAllocator::Scope scope(allocator);
+    int *bin = nullptr;
+    if (useBin) {
+        bin = allocator.alloc<int>((1 << stepCount) + 1);
+        precomputeBin(hayStack.aligned, hayStack.count, bin, stepCount);
+    }
+    avx256EytzingerRangeCheckBinWrite<BinStepCount, SortSimdBatchCount, Stats>(
+        hayStack, needles, writer, allocator, bin, stepCount);
+}
 
-                // const int testValue = step < stepCount ? bin[binIdx] :
-                // hayStack[left + half];
-                const __m256i leftHalf = _mm256_add_epi32(left, half);
-                const __m256i testValue = _mm256_i32gather_epi32(bin, binIndex, sizeof(int));
+/// @tparam Stats - NoStats or SearchStats to count where the needles and cycles go
+template <int BinStepCount, int SortSimdBatchCount, typename Stats = NoStats>
+static void avx256EytzingerRangeCheck(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
+{
+    IndexWriter writer{indices.aligned};
+    avx256EytzingerRangeCheckWrite<BinStepCount, SortSimdBatchCount, Stats>(
+        hayStack, needles, writer, allocator);
+}
 
-                // if (testValue < value) {
-                const __m256i gt = _mm256_cmpgt_epi32(testValue, value);
-                const __m256i eq = _mm256_cmpeq_epi32(testValue, value);
-                const __m256i ltMask = _mm256_andnot_si256(
-                    _mm256_castps_si256(
-                        _mm256_or_ps(_mm256_castsi256_ps(gt), _mm256_castsi256_ps(eq))),
-                    neg1);
+/// Same search as avx256EytzingerRangeCheck that only reports which needles are present
+/// @param bits - (needles.count + 7) / 8 bytes, bit c is set when needles[c] is in the haystack
+template <int BinStepCount, int SortSimdBatchCount>
+static void avx256EytzingerRangeCheckBitmap(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    uint8_t *bits,
+    ArenaAllocator &allocator)
+{
+    BitmapWriter writer{bits};
+    avx256EytzingerRangeCheckWrite<BinStepCount, SortSimdBatchCount, NoStats>(
+        hayStack, needles, writer, allocator);
+}
 
-                // true branch
-                const __m256i lt_left = _mm256_add_epi32(leftHalf, ones);
-                const __m256i lt_count = _mm256_sub_epi32(count, _mm256_add_epi32(half, ones));
-                const __m256i lt_binIdx = _mm256_add_epi32(_mm256_slli_epi32(binIndex, 1), ones);
+/// Same search as avx256EytzingerRangeCheck that only counts the needles present in the haystack
+template <int BinStepCount, int SortSimdBatchCount>
+static int64_t avx256EytzingerRangeCheckCount(
+    const AlignedIntArray &hayStack, const AlignedIntArray &needles, ArenaAllocator &allocator)
+{
+    CountWriter writer;
+    avx256EytzingerRangeCheckWrite<BinStepCount, SortSimdBatchCount, NoStats>(
+        hayStack, needles, writer, allocator);
+    return writer.hits;
+}
 
-                // false branch
-                const __m256i gt_eq_binIndex = _mm256_slli_epi32(binIndex, 1);
+namespace {
+/// avx256EytzingerRangeCheck behind a MembershipFilter, needles the filter rejects are answered
+/// without a descent
+/// The bin and the filter are built once by init, the haystack is not copied and must outlive
+/// the index
+template <int BinStepCount, int SortSimdBatchCount, typename Stats = NoStats>
+struct Avx256PrefilterSearch {
+    const AlignedIntArray *hayStack = nullptr;
+    /// Top levels of the search, element 0 is unused
+    AlignedIntArray bin;
+    int stepCount = 0;
+    MembershipFilter filter;
+
+    void init(const AlignedIntArray &newHayStack)
+    {
+        hayStack = &newHayStack;
+        // deeper levels would contain empty sub-ranges
+        stepCount = std::min(BinStepCount, int(log2(hayStack->getCount() + 1)));
+        bin.init((1 << stepCount) + 1);
+        parallelPrecomputeBin(hayStack->get(), hayStack->getCount(), bin, stepCount);
+        filter.init(newHayStack);
+    }
 
-                // mix with result
-                binIndex = masked_blend(lt_binIdx, gt_eq_binIndex, ltMask);
-                count = masked_blend(lt_count, half, ltMask);
-                left = masked_blend(lt_left, left, ltMask);
-            }
+    /// Bytes of the bin and the filter, without the haystack
+    int64_t memoryBytes() const
+    {
+        return bin.getCount() * int64_t(sizeof(int)) + filter.memoryBytes();
+    }
 
-            for (; step < binSearchSteps; ++step) {
-                // const int half = count / 2;
-                const __m256i half = _mm256_srli_epi32(count, 1);
+    void search(
+        const AlignedIntArray &needles, AlignedIndexArray &indices, ArenaAllocator &allocator) const
+    {
+        IndexWriter writer{indices.aligned};
+        avx256EytzingerRangeCheckBinWrite<BinStepCount, SortSimdBatchCount, Stats>(
+            *hayStack, needles, writer, allocator, bin, stepCount, &filter);
+    }
+};
+} // namespace
 
-                // const int testValue = hayStack[left + half];
-                const __m256i leftHalf = _mm256_add_epi32(left, half);
-                const __m256i testValue =
-                    _mm256_i32gather_epi32(haystackPtr, leftHalf, sizeof(int));
+/// The avx256Eytzinger traversal with the results passed to @writer
+/// @param bin - top BinStepCount levels of the search as built by precomputeBin, 1 based, or
+/// nullptr to search every needle serially, a bin needs a haystack of at most INT_MAX values
+/// @tparam Stats - NoStats or SearchStats to count where the needles and cycles go
+template <int BinStepCount, typename Stats, typename Writer>
+static void avx256EytzingerTraversal(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    Writer &writer,
+    const int *bin)
+{
+    const int64_t haystackCount = hayStack.count;
+    const int64_t needlesCount = needles.count;
 
-                // if (testValue < value) {
-                const __m256i gt = _mm256_cmpgt_epi32(testValue, value);
-                const __m256i eq = _mm256_cmpeq_epi32(testValue, value);
-                const __m256i ltMask = _mm256_andnot_si256(
-                    _mm256_castps_si256(
-                        _mm256_or_ps(_mm256_castsi256_ps(gt), _mm256_castsi256_ps(eq))),
-                    neg1);
+    // the bin is only there for haystacks that fill it, the unrolled bin steps need all levels
+    const bool useSIMD = needlesCount > 1024 && bin;
+    const int stepCount = bin ? BinStepCount : 0;
+    const int *haystackPtr = hayStack.aligned;
 
-                // true branch
-                const __m256i lt_left = _mm256_add_epi32(leftHalf, ones); //
-                const __m256i lt_count =
-                    _mm256_sub_epi32(count, _mm256_add_epi32(half, ones)); // count - (half + 1)
-                const __m256i lt_binIdx = _mm256_add_epi32(_mm256_slli_epi32(binIndex, 1), ones);
+    int64_t c = 0;
 
-                // false branch
-                const __m256i gt_eq_binIndex = _mm256_slli_epi32(binIndex, 1);
+    auto simdLoop = [&](auto haystackSteps) {
+        constexpr int HaystackSteps = decltype(haystackSteps)::value;
+        const __m256i zeros = _mm256_set1_epi32(0);
+        const __m256i haystackCountV = _mm256_set1_epi32(int(haystackCount));
 
-                // mix with result
-                binIndex = masked_blend(lt_binIdx, gt_eq_binIndex, ltMask);
-                count = masked_blend(lt_count, half, ltMask);
-                left = masked_blend(lt_left, left, ltMask);
-            }
+        for (; c + 8 < needlesCount; c += 8) {
+            const __m256i value =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(needles.get() + c));
+            __m256i left = zeros;
+            __m256i count = haystackCountV;
+            eytzingerBinStepsSIMD<BinStepCount>(bin, value, left, count);
+            eytzingerHaystackStepsSIMD<HaystackSteps>(haystackPtr, value, left, count);
 
             const __m256i haystackLeft = _mm256_i32gather_epi32(haystackPtr, left, sizeof(int));
             // if (hayStack[left] == value) {
             const __m256i eqMask = _mm256_cmpeq_epi32(value, haystackLeft);
-            const __m256i storeResult = masked_blend(left, neg1, eqMask);
-
-            // search values are not consecutive, scatter according to their
-            // indices there is no scatter_epi32 in AVX/AVX2
-            alignas(32) int writeBack[8];
-            _mm256_store_si256(reinterpret_cast<__m256i *>(writeBack), storeResult);
-            for (int r = 0; r < 8; r++) {
-                indicesPtr[r + c] = writeBack[r];
-            }
-            c += 8;
+
+            writer.store8(c, left, eqMask);
+            Stats::simdNeedles(8);
+            Stats::steps(BinStepCount, HaystackSteps, 8);
         }
+    };
+    if (useSIMD) {
+        dispatchHaystackSteps<BinStepCount>(haystackCount, simdLoop);
     }
 
-    serialFinishSIMDEytzinger(c, needlesCount, stepCount, bin, hayStack, needles, indices);
+    serialFinishSIMDEytzinger<Stats>(
+        c, needlesCount, stepCount, bin, hayStack, needles, writer);
+}
 
-    allocator.freeAll();
+/// avx256Eytzinger with a bin built by the caller and the results passed to @writer
+/// Small haystacks and haystacks over INT_MAX are searched without the traversal
+/// @param bin - top BinStepCount levels of the search as built by precomputeBin, 1 based, it
+/// must be there for haystacks of [(1 << BinStepCount) - 1, INT_MAX] values over
+/// LinearScanMaxCount searched with more than 1024 needles, nullptr for the others
+/// @tparam Stats - NoStats or SearchStats to count where the needles and cycles go
+template <int BinStepCount, typename Stats, typename Writer>
+static void avx256EytzingerBinWrite(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    Writer &writer,
+    ArenaAllocator &allocator,
+    const int *bin)
+{
+    if (hayStack.count <= LinearScanMaxCount) {
+        Stats::shortcutNeedles(needles.count);
+        return avx256LinearScanWrite(hayStack, needles, writer, allocator);
+    }
+
+    // lanes and queue items hold 32 bit indices
+    if (hayStack.count > INT_MAX) {
+        Stats::shortcutNeedles(needles.count);
+        return avx256WideSearch(hayStack, needles, writer);
+    }
+
+    avx256EytzingerTraversal<BinStepCount, Stats>(hayStack, needles, writer, bin);
 }
 
-static void avx256(
+/// avx256Eytzinger with a bin built per call and the results passed to @writer, the index,
+/// bitmap and count modes all go through it
+/// @tparam Stats - NoStats or SearchStats to count where the needles and cycles go
+template <int BinStepCount, typename Stats, typename Writer>
+static void avx256EytzingerWrite(
     const AlignedIntArray &hayStack,
     const AlignedIntArray &needles,
-    AlignedIntArray &indices,
-    StackAllocator &)
+    Writer &writer,
+    ArenaAllocator &allocator)
 {
-    const int haystackCount = int(hayStack.count);
-    const int needlesCount = int(needles.count);
+    const int64_t haystackCount = hayStack.count;
+    const bool useBin = needles.count > 1024 && haystackCount > LinearScanMaxCount &&
+        haystackCount <= INT_MAX && haystackCount >= (1 << BinStepCount) - 1;
 
-    const bool useSIMD = (haystackCount > (1024 * 100)) && (needlesCount > 1024);
-    int *indicesPtr = indices.aligned;
-    const int *haystackPtr = hayStack.aligned;
+    const ArenaAllocator::Scope scope(allocator);
+    int *bin = nullptr;
+    if (useBin) {
+        bin = allocator.alloc<int>((1 << BinStepCount) + 1);
+        precomputeBin(hayStack.aligned, haystackCount, bin, BinStepCount);
+    }
+    avx256EytzingerBinWrite<BinStepCount, Stats>(hayStack, needles, writer, allocator, bin);
+}
+
+/// Search of 8 needles per AVX2 register, the top BinStepCount steps read a bin built per call
+/// on the calling thread, Avx256EytzingerSearch builds it once
+/// Both the bin steps and the haystack steps are unrolled, the haystack steps in one
+/// instantiation of the needle loop per size class of the haystack
+/// @tparam Stats - NoStats or SearchStats to count where the needles and cycles go
+template <int BinStepCount, typename Stats = NoStats>
+static void avx256Eytzinger(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
+{
+    IndexWriter writer{indices.aligned};
+    avx256EytzingerWrite<BinStepCount, Stats>(hayStack, needles, writer, allocator);
+}
 
-    int c = 0;
+/// Same search as avx256Eytzinger that only reports which needles are present
+/// @param bits - (needles.count + 7) / 8 bytes, bit c is set when needles[c] is in the haystack
+template <int BinStepCount>
+static void avx256EytzingerBitmap(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    uint8_t *bits,
+    ArenaAllocator &allocator)
+{
+    BitmapWriter writer{bits};
+    avx256EytzingerWrite<BinStepCount, NoStats>(hayStack, needles, writer, allocator);
+}
+
+/// Same search as avx256Eytzinger that only counts the needles present in the haystack
+template <int BinStepCount>
+static int64_t avx256EytzingerCount(
+    const AlignedIntArray &hayStack, const AlignedIntArray &needles, ArenaAllocator &allocator)
+{
+    CountWriter writer;
+    avx256EytzingerWrite<BinStepCount, NoStats>(hayStack, needles, writer, allocator);
+    return writer.hits;
+}
+
+namespace {
+/// avx256Eytzinger with the bin built once by init, split across threads with
+/// parallelPrecomputeBin
+/// The haystack is not copied and must outlive the index
+template <int BinStepCount>
+struct Avx256EytzingerSearch {
+    const AlignedIntArray *hayStack = nullptr;
+    /// Top levels of the search, element 0 is unused
+    AlignedIntArray bin;
+    /// False for haystacks the SIMD loop does not search
+    bool hasBin = false;
+
+    void init(const AlignedIntArray &newHayStack)
+    {
+        hayStack = &newHayStack;
+        const int64_t haystackCount = hayStack->getCount();
+        hasBin = haystackCount > LinearScanMaxCount && haystackCount <= INT_MAX &&
+            haystackCount >= (1 << BinStepCount) - 1;
+        if (hasBin) {
+            bin.init((1 << BinStepCount) + 1);
+            parallelPrecomputeBin(hayStack->get(), haystackCount, bin, BinStepCount);
+        }
+    }
+
+    /// Bytes of the bin, without the haystack
+    int64_t memoryBytes() const
+    {
+        return hasBin ? bin.getCount() * int64_t(sizeof(int)) : 0;
+    }
+
+    void search(
+        const AlignedIntArray &needles, AlignedIndexArray &indices, ArenaAllocator &allocator) const
+    {
+        IndexWriter writer{indices.aligned};
+        avx256EytzingerBinWrite<BinStepCount, NoStats>(
+            *hayStack, needles, writer, allocator, hasBin ? bin.get() : nullptr);
+    }
+};
+} // namespace
+
+namespace {
+/// The avx256 traversal with the results passed to @writer, needles before @c are skipped
+template <typename Writer>
+void avx256Search(
+    const AlignedIntArray &hayStack, const AlignedIntArray &needles, Writer &writer, int64_t c = 0)
+{
+    const int64_t haystackCount = hayStack.count;
+    const int64_t needlesCount = needles.count;
+
+    const bool useSIMD = needlesCount > 1024;
+    const int *haystackPtr = hayStack.aligned;
 
     const __m256i zeros = _mm256_set1_epi32(0);
     const __m256i ones = _mm256_set1_epi32(1);
     const __m256i neg1 = _mm256_set1_epi32(-1); // all true mask
-    const __m256i haystackCountV = _mm256_set1_epi32(haystackCount);
+    const __m256i haystackCountV = _mm256_set1_epi32(int(haystackCount));
 
-    if (useSIMD) {
+    if (useSIMD && haystackCount <= INT_MAX) {
         const int binSearchSteps = int(log2(haystackCount)) + 1;
 
         while (c + 8 < needlesCount) {
@@ -467,12 +758,45 @@ static void avx256(
             const __m256i haystackLeft = _mm256_i32gather_epi32(haystackPtr, left, sizeof(int));
             // if (hayStack[left] == value) {
             const __m256i eqMask = _mm256_cmpeq_epi32(value, haystackLeft);
-            const __m256i storeResult = masked_blend(left, neg1, eqMask);
 
-            _mm256_store_si256(reinterpret_cast<__m256i *>(indicesPtr + c), storeResult);
+            writer.store8(c, left, eqMask);
             c += 8;
         }
     }
 
-    serialFinishSIMD(c, needlesCount, hayStack, needles, indices);
-}
\ No newline at end of file
+    serialFinishSIMD(c, needlesCount, hayStack, needles, writer);
+}
+} // namespace
+
+/// The avx256 search with the results passed to @writer, the index, bitmap and count modes all
+/// go through it
+/// A bitmap stores the equality mask of each 8 needles as one byte with a movemask, so there is
+/// no index widening and 64 times less output than the indices
+template <typename Writer>
+static void avx256Write(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    Writer &writer,
+    ArenaAllocator &allocator)
+{
+    if (hayStack.count <= LinearScanMaxCount) {
+        return avx256LinearScanWrite(hayStack, needles, writer, allocator);
+    }
+
+    int64_t c = 0;
+    if (needles.count > 1024 && hayStack.count > INT_MAX) {
+        c = avx256Wide(hayStack, needles, writer);
+    }
+
+    avx256Search(hayStack, needles, writer, c);
+}
+
+static void avx256(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
+{
+    IndexWriter writer{indices.aligned};
+    avx256Write(hayStack, needles, writer, allocator);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "utils.hpp"
+#include "parallel.hpp"
+
+#ifndef __clang__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <bit>
+
+/// Levels of the haystack kept in the bin of a LatencySearch, 128KB so it stays in L2
+const int LatencyBinSteps = 15;
+
+namespace {
+/// Index for one lookup at a time, for request paths that care about the latency of each lookup
+/// The bin is built once by init, so find does no allocation and no rebuild
+/// The haystack is not copied and must outlive the index
+struct LatencySearch {
+    const int *hayStack = nullptr;
+    int64_t haystackCount = 0;
+    /// Same layout as the bin of eytzingerSearch, bin[1] is the root
+    AlignedIntArray bin;
+    int binSteps = 0;
+
+    void init(const AlignedIntArray &newHayStack)
+    {
+        hayStack = newHayStack.get();
+        haystackCount = newHayStack.getCount();
+        // only levels where every subtree is non empty, so find needs no count check in the bin
+        binSteps = std::min(LatencyBinSteps, int(std::bit_width(uint64_t(haystackCount + 1))) - 1);
+        bin.init(int64_t(1) << std::max(binSteps, 1));
+        if (binSteps > 0) {
+            parallelPrecomputeBin(hayStack, haystackCount, bin.get(), binSteps);
+        }
+    }
+
+    /// Branchless lower bound of @value, the compare result selects the next range with
+    /// conditional moves and both children of the next step are prefetched
+    /// @return index of the first element equal to @value or -1
+    int64_t find(int value) const
+    {
+        const int *binPtr = bin.get();
+        int64_t left = 0;
+        int64_t count = haystackCount;
+        int64_t binIdx = 1;
+
+        for (int step = 0; step < binSteps; step++) {
+            // the 16 nodes 4 levels below share a cache line of the bin, the last 4 levels have
+            // no nodes that far below them in the bin
+            if (step + 4 < binSteps) {
+                _mm_prefetch(reinterpret_cast<const char *>(binPtr + binIdx * 16), _MM_HINT_T0);
+            }
+            const int64_t half = count / 2;
+            const bool less = binPtr[binIdx] < value;
+            left = less ? left + half + 1 : left;
+            count = less ? count - half - 1 : half;
+            binIdx = binIdx * 2 + less;
+        }
+
+        while (count > 0) {
+            const int64_t half = count / 2;
+            // middles of both possible next ranges, one of them is read in the next step
+            _mm_prefetch(reinterpret_cast<const char *>(hayStack + left + half / 2), _MM_HINT_T0);
+            _mm_prefetch(
+                reinterpret_cast<const char *>(hayStack + left + half + 1 + (count - half - 1) / 2),
+                _MM_HINT_T0);
+            const bool less = hayStack[left + half] < value;
+            left = less ? left + half + 1 : left;
+            count = less ? count - half - 1 : half;
+        }
+
+        return left < haystackCount && hayStack[left] == value ? left : NOT_FOUND;
+    }
+};
+} // namespace
@@ -7,13 +7,13 @@
 static void stlLowerBound(
     const AlignedIntArray &hayStack,
     const AlignedIntArray &needles,
-    AlignedIntArray &indices,
-    StackAllocator &allocator)
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
 {
-    for (int c = 0; c < needles.getCount(); c++) {
+    for (int64_t c = 0; c < needles.getCount(); c++) {
         const int value = needles[c];
         const int *pos = std::lower_bound(hayStack.begin(), hayStack.end(), value);
-        const int idx = std::distance(hayStack.begin(), pos);
+        const int64_t idx = std::distance(hayStack.begin(), pos);
 
         if (idx == hayStack.getCount() || hayStack[idx] != value) {
             indices[c] = NOT_FOUND;
@@ -27,11 +27,11 @@ static void stlLowerBound(
 static void stlLowerBoundTransform(
     const AlignedIntArray &hayStack,
     const AlignedIntArray &needles,
-    AlignedIntArray &indices,
-    StackAllocator &allocator)
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
 {
-    std::transform(needles.begin(), needles.end(), indices.begin(), [&hayStack](int value) {
-        const int idx = std::distance(
+    std::transform(needles.begin(), needles.end(), indices.begin(), [&hayStack](int value) -> int64_t {
+        const int64_t idx = std::distance(
             hayStack.begin(), std::lower_bound(hayStack.begin(), hayStack.end(), value));
 
         if (idx == hayStack.getCount() || hayStack[idx] != value) {
@@ -45,11 +45,11 @@ static void stlLowerBoundTransform(
 static void stlRanges(
     const AlignedIntArray &hayStack,
     const AlignedIntArray &needles,
-    AlignedIntArray &indices,
-    StackAllocator &allocator)
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
 {
-    std::ranges::transform(needles, indices.begin(), [&hayStack](int value) {
-        const int idx = std::distance(hayStack.begin(), std::ranges::lower_bound(hayStack, value));
+    std::ranges::transform(needles, indices.begin(), [&hayStack](int value) -> int64_t {
+        const int64_t idx = std::distance(hayStack.begin(), std::ranges::lower_bound(hayStack, value));
 
         if (idx == hayStack.getCount() || hayStack[idx] != value) {
             return NOT_FOUND;
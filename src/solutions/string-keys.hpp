@@ -0,0 +1,209 @@
+#pragma once
+
+#include "utils.hpp"
+
+#ifndef __clang__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <string_view>
+
+/// Bytes of each key kept in the prefix array
+const int StringPrefixBytes = sizeof(uint64_t);
+
+namespace {
+/// Variable length strings stored back to back
+/// String i is [offsets[i], offsets[i + 1]) of @chars
+struct StringArray {
+    AlignedArrayPtr<char> chars;
+    /// count + 1 entries, the last one is the total number of bytes
+    AlignedArrayPtr<int64_t> offsets;
+    int64_t count = 0;
+
+    /// Allocate @newCount strings with @totalBytes bytes, offsets are filled by the caller
+    void init(int64_t newCount, int64_t totalBytes)
+    {
+        // arrays can't be empty, but all strings can
+        chars.init(std::max<int64_t>(1, totalBytes));
+        offsets.init(newCount + 1);
+        count = newCount;
+    }
+
+    std::string_view operator[](int64_t index) const
+    {
+        return std::string_view(chars.get() + offsets[index], offsets[index + 1] - offsets[index]);
+    }
+
+    int64_t getCount() const
+    {
+        return count;
+    }
+};
+
+/// The first StringPrefixBytes of @str as a big-endian number, so numbers compare like the
+/// strings do, shorter strings are padded with zeros
+/// The top bit is flipped to make the signed order of the result the unsigned order of the bytes
+inline int64_t stringPrefixKey(std::string_view str)
+{
+    uint64_t prefix = 0;
+    memcpy(&prefix, str.data(), std::min<size_t>(str.size(), StringPrefixBytes));
+    if constexpr (std::endian::native == std::endian::little) {
+        prefix = __builtin_bswap64(prefix);
+    }
+    return int64_t(prefix ^ (uint64_t(1) << 63));
+}
+
+/// Sorted string haystack with the prefix key of every string in a contiguous array
+/// Searches compare the prefix keys and read the strings only when the prefixes are equal
+struct StringHayStack {
+    StringArray keys;
+    AlignedArrayPtr<int64_t> prefixes;
+
+    /// Fill the prefix keys, call after the strings are sorted
+    void build()
+    {
+        prefixes.init(std::max<int64_t>(1, keys.count));
+        prefixes.count = keys.count;
+        for (int64_t c = 0; c < keys.count; c++) {
+            prefixes[c] = stringPrefixKey(keys[c]);
+        }
+    }
+};
+
+/// Finish the search of @needle once @left is the first string with a prefix key not less than
+/// @prefix, strings with the same prefix key are binary searched by full comparison
+/// Short needles search the tie too, the zero padding makes "a" and "a\0" the same key
+inline int64_t resolvePrefixTie(
+    const StringHayStack &hayStack, int64_t left, int64_t prefix, std::string_view needle)
+{
+    const int64_t haystackCount = hayStack.keys.count;
+    if (left == haystackCount || hayStack.prefixes[left] != prefix) {
+        return NOT_FOUND;
+    }
+
+    // gallop to the end of the tie in 2 * log2(tie) reads of the prefixes, most ties are a few
+    // strings but most needles land in the few big ones, ~32K strings for a string-test needle
+    const int64_t *prefixesPtr = hayStack.prefixes.get();
+    int64_t step = 1;
+    while (left + step < haystackCount && prefixesPtr[left + step] == prefix) {
+        step *= 2;
+    }
+    const int64_t tieEnd = std::upper_bound(prefixesPtr + left + step / 2,
+        prefixesPtr + std::min(left + step, haystackCount), prefix) - prefixesPtr;
+    int64_t count = tieEnd - left;
+    while (count > 0) {
+        const int64_t half = count / 2;
+        if (hayStack.keys[left + half] < needle) {
+            left = left + half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+    return left < tieEnd && hayStack.keys[left] == needle ? left : NOT_FOUND;
+}
+} // namespace
+
+/// Binary search over the prefix keys, full strings only break prefix ties
+/// @param indices - index of the first equal string or -1
+static void stringBinarySearch(
+    const StringHayStack &hayStack, const StringArray &needles, AlignedIndexArray &indices)
+{
+    const int64_t haystackCount = hayStack.keys.count;
+    const int64_t *prefixesPtr = hayStack.prefixes.get();
+
+    for (int64_t c = 0; c < needles.count; c++) {
+        const std::string_view needle = needles[c];
+        const int64_t prefix = stringPrefixKey(needle);
+
+        int64_t left = 0;
+        int64_t count = haystackCount;
+
+        while (count > 0) {
+            const int64_t half = count / 2;
+
+            if (prefixesPtr[left + half] < prefix) {
+                left = left + half + 1;
+                count -= half + 1;
+            } else {
+                count = half;
+            }
+        }
+
+        indices[c] = resolvePrefixTie(hayStack, left, prefix, needle);
+    }
+}
+
+/// Same as stringBinarySearch with 4 needles per AVX2 register, the prefix keys are 64 bit so
+/// this is the avx256Wide loop with 64 bit compares
+/// Only the prefix key search is vectorized, the ties are resolved one needle at a time as in
+/// stringBinarySearch and take most of the time, so this is no faster than it in string-test
+static void avx256StringSearch(
+    const StringHayStack &hayStack, const StringArray &needles, AlignedIndexArray &indices)
+{
+    const int64_t haystackCount = hayStack.keys.count;
+    const int64_t needlesCount = needles.count;
+    if (haystackCount == 0) {
+        return stringBinarySearch(hayStack, needles, indices);
+    }
+
+    const int64_t *prefixesPtr = hayStack.prefixes.get();
+    const long long *gatherBase = reinterpret_cast<const long long *>(prefixesPtr);
+
+    const __m256i ones = _mm256_set1_epi64x(1);
+    const __m256i haystackCountV = _mm256_set1_epi64x(haystackCount);
+    const int binSearchSteps = int(std::bit_width(uint64_t(haystackCount)));
+
+    alignas(32) int64_t prefix[4];
+    alignas(32) int64_t left[4];
+
+    int64_t c = 0;
+    for (; c + 4 <= needlesCount; c += 4) {
+        for (int r = 0; r < 4; r++) {
+            prefix[r] = stringPrefixKey(needles[c + r]);
+        }
+        const __m256i value = _mm256_load_si256(reinterpret_cast<const __m256i *>(prefix));
+        __m256i leftV = _mm256_setzero_si256();
+        __m256i count = haystackCountV;
+
+        for (int step = 0; step < binSearchSteps; ++step) {
+            // const int64_t half = count / 2;
+            const __m256i half = _mm256_srli_epi64(count, 1);
+
+            // const int64_t testValue = prefixes[left + half];
+            // lanes that are done have count 0 and may point one past the end
+            const __m256i leftHalf = _mm256_add_epi64(leftV, half);
+            const __m256i probe = _mm256_blendv_epi8(
+                leftHalf, _mm256_setzero_si256(), _mm256_cmpeq_epi64(leftHalf, haystackCountV));
+            const __m256i testValue = _mm256_i64gather_epi64(gatherBase, probe, sizeof(int64_t));
+
+            // if (count > 0 && testValue < value) {
+            const __m256i ltMask = _mm256_andnot_si256(
+                _mm256_cmpeq_epi64(count, _mm256_setzero_si256()),
+                _mm256_cmpgt_epi64(value, testValue));
+
+            // true branch
+            const __m256i lt_left = _mm256_add_epi64(leftHalf, ones);
+            const __m256i lt_count = _mm256_sub_epi64(count, _mm256_add_epi64(half, ones));
+
+            count = _mm256_blendv_epi8(half, lt_count, ltMask);
+            leftV = _mm256_blendv_epi8(leftV, lt_left, ltMask);
+        }
+
+        _mm256_store_si256(reinterpret_cast<__m256i *>(left), leftV);
+        for (int r = 0; r < 4; r++) {
+            indices[c + r] = resolvePrefixTie(hayStack, left[r], prefix[r], needles[c + r]);
+        }
+    }
+
+    for (; c < needlesCount; c++) {
+        const std::string_view needle = needles[c];
+        const int64_t needlePrefix = stringPrefixKey(needle);
+        const int64_t left =
+            std::lower_bound(prefixesPtr, prefixesPtr + haystackCount, needlePrefix) - prefixesPtr;
+        indices[c] = resolvePrefixTie(hayStack, left, needlePrefix, needle);
+    }
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+#include "utils.hpp"
+#include "baseline.hpp"
+#include "simd-avx256.hpp"
+
+#ifndef __clang__
+#include <immintrin.h>
+#endif
+
+#include <bit>
+#include <climits>
+#include <cmath>
+
+namespace {
+/// Store the haystack range of every node at depth @depth, in the same order as precomputeBin
+void precomputeTiles(
+    int64_t left,
+    int64_t size,
+    int64_t *tileLeft,
+    int64_t *tileCount,
+    const int depth,
+    int step = 0,
+    int binIdx = 1)
+{
+    if (step == depth) {
+        tileLeft[binIdx - (1 << depth)] = left;
+        tileCount[binIdx - (1 << depth)] = size;
+        return;
+    }
+
+    const int64_t half = size / 2;
+    precomputeTiles(left, half, tileLeft, tileCount, depth, step + 1, binIdx * 2);
+    precomputeTiles(
+        left + half + 1, size - half - 1, tileLeft, tileCount, depth, step + 1, binIdx * 2 + 1);
+}
+
+/// Search @count needles that all fall in the same tile with AVX2, 8 at a time
+/// @param items - pairs of (needle, index in needles) as in avx256EytzingerRangeCheck's queue
+/// @return the number of items searched, the rest are left for the scalar code
+inline int64_t avx256Tile(
+    const int *haystackPtr,
+    int64_t left,
+    int64_t count,
+    const int *items,
+    int64_t itemCount,
+    int64_t *indicesPtr)
+{
+    const __m256i ones = _mm256_set1_epi32(1);
+    const __m256i neg1 = _mm256_set1_epi32(-1); // all true mask
+    const __m256i tileLeftV = _mm256_set1_epi32(int(left));
+    const __m256i tileCountV = _mm256_set1_epi32(int(count));
+    const int binSearchSteps = std::bit_width(uint64_t(count));
+
+    int64_t c = 0;
+    for (; c + 8 <= itemCount; c += 8) {
+        const __m256i value = _mm256_i32gather_epi32(
+            items + c * 2, _mm256_set_epi32(14, 12, 10, 8, 6, 4, 2, 0), sizeof(int));
+        __m256i leftV = tileLeftV;
+        __m256i countV = tileCountV;
+
+        for (int step = 0; step < binSearchSteps; ++step) {
+            // const int half = count / 2;
+            const __m256i half = _mm256_srli_epi32(countV, 1);
+
+            // const int testValue = hayStack[left + half];
+            const __m256i leftHalf = _mm256_add_epi32(leftV, half);
+            const __m256i testValue = _mm256_i32gather_epi32(haystackPtr, leftHalf, sizeof(int));
+
+            // if (testValue < value) {
+            const __m256i ltMask = _mm256_cmpgt_epi32(value, testValue);
+
+            // true branch
+            const __m256i lt_left = _mm256_add_epi32(leftHalf, ones);
+            const __m256i lt_count = _mm256_sub_epi32(countV, _mm256_add_epi32(half, ones));
+
+            countV = _mm256_blendv_epi8(half, lt_count, ltMask);
+            leftV = _mm256_blendv_epi8(leftV, lt_left, ltMask);
+        }
+
+        const __m256i haystackLeft = _mm256_i32gather_epi32(haystackPtr, leftV, sizeof(int));
+        // if (hayStack[left] == value) {
+        const __m256i eqMask = _mm256_cmpeq_epi32(value, haystackLeft);
+        const __m256i storeResult = _mm256_blendv_epi8(neg1, leftV, eqMask);
+
+        alignas(32) int writeBack[8];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(writeBack), storeResult);
+        for (int r = 0; r < 8; r++) {
+            indicesPtr[items[(c + r) * 2 + 1]] = writeBack[r];
+        }
+    }
+    return c;
+}
+
+/// Partition all needles by the subtree at depth @TileDepth of the bin they fall in, then
+/// search each subtree's needles together so the subtree's haystack lines stay in cache
+template <int TileDepth, bool UseSIMD>
+void tiledSearch(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
+{
+    const int64_t haystackCount = hayStack.count;
+    const int64_t needlesCount = needles.count;
+    const int lowCut = hayStack[0];
+    const int highCut = hayStack[haystackCount - 1];
+
+    // items keep the needle index in 32 bits
+    if (needlesCount > INT_MAX) {
+        return binarySearch(hayStack, needles, indices);
+    }
+    // lanes keep haystack indices in 32 bits, the scalar tiles have no such limit
+    if constexpr (UseSIMD) {
+        if (haystackCount > INT_MAX) {
+            return tiledSearch<TileDepth, false>(hayStack, needles, indices, allocator);
+        }
+    }
+
+    // deeper levels would contain empty tiles
+    const int depth = std::min(TileDepth, int(log2(haystackCount + 1)));
+    const int tileCount = 1 << depth;
+
+    const ArenaAllocator::Scope scope(allocator);
+    int *bin = allocator.alloc<int>(tileCount + 1);
+    int64_t *tileLeft = allocator.alloc<int64_t>(tileCount);
+    int64_t *tileSize = allocator.alloc<int64_t>(tileCount);
+    int64_t *tileStart = allocator.alloc<int64_t>(tileCount + 1);
+    int *needleTile = allocator.alloc<int>(needlesCount);
+    int *items = allocator.alloc<int>(needlesCount * 2);
+    if (!bin || !tileLeft || !tileSize || !tileStart || !needleTile || !items) {
+        return binarySearch(hayStack, needles, indices);
+    }
+
+    precomputeBin(hayStack, haystackCount, bin, depth);
+    precomputeTiles(0, haystackCount, tileLeft, tileSize, depth);
+    memset(tileStart, 0, sizeof(int64_t) * (tileCount + 1));
+
+    // find the tile of every needle in the bin and count the needles per tile
+    for (int64_t c = 0; c < needlesCount; c++) {
+        const int value = needles[c];
+        if (value < lowCut || value > highCut) {
+            indices[c] = NOT_FOUND;
+            needleTile[c] = -1;
+            continue;
+        }
+
+        int binIdx = 1;
+        for (int step = 0; step < depth; step++) {
+            binIdx = binIdx * 2 + (bin[binIdx] < value);
+        }
+        needleTile[c] = binIdx - tileCount;
+        ++tileStart[needleTile[c] + 1];
+    }
+
+    for (int t = 0; t < tileCount; t++) {
+        tileStart[t + 1] += tileStart[t];
+    }
+
+    // counting sort of (needle, index) by tile, tileStart[t] ends up at the end of tile t
+    for (int64_t c = 0; c < needlesCount; c++) {
+        if (needleTile[c] != -1) {
+            const int64_t position = tileStart[needleTile[c]]++;
+            items[position * 2] = needles[c];
+            items[position * 2 + 1] = int(c);
+        }
+    }
+
+    int64_t begin = 0;
+    for (int t = 0; t < tileCount; t++) {
+        const int64_t end = tileStart[t];
+        int64_t c = begin;
+        if (UseSIMD) {
+            c += avx256Tile(
+                hayStack.aligned,
+                tileLeft[t],
+                tileSize[t],
+                items + begin * 2,
+                end - begin,
+                indices.aligned);
+        }
+
+        for (; c < end; c++) {
+            const int value = items[c * 2];
+            int64_t left = tileLeft[t];
+            int64_t count = tileSize[t];
+
+            while (count > 0) {
+                const int64_t half = count / 2;
+
+                if (hayStack[left + half] < value) {
+                    left = left + half + 1;
+                    count -= half + 1;
+                } else {
+                    count = half;
+                }
+            }
+
+            indices[items[c * 2 + 1]] = hayStack[left] == value ? left : NOT_FOUND;
+        }
+        begin = end;
+    }
+}
+} // namespace
+
+/// Binary search over needles grouped by the subtree at depth TileDepth they fall in
+template <int TileDepth>
+static void binarySearchTiled(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
+{
+    tiledSearch<TileDepth, false>(hayStack, needles, indices, allocator);
+}
+
+/// AVX2 search over needles grouped by the subtree at depth TileDepth they fall in
+/// All lanes of a tile start from the same interval, so there is no per lane setup
+template <int TileDepth>
+static void avx256Tiled(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
+{
+    tiledSearch<TileDepth, true>(hayStack, needles, indices, allocator);
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "utils.hpp"
+#include "baseline.hpp"
+#include "simd-avx256.hpp"
+
+#ifndef __clang__
+#include <immintrin.h>
+#endif
+
+#include <array>
+#include <bit>
+#include <climits>
+#include <utility>
+
+/// Largest size class with an unrolled kernel, bigger haystacks use binarySearch
+const int MaxUnrolledLog2 = 40;
+/// Largest size class of the AVX2 kernel, lanes hold 32 bit indices
+const int MaxUnrolledLog2SIMD = 30;
+
+namespace {
+/// Size class of a haystack: the log2 of the biggest power of two not above @count
+inline int sizeClass(int64_t count)
+{
+    return int(std::bit_width(uint64_t(count))) - 1;
+}
+
+/// Branchless lower bound with steps fixed by the size class (Shar's method)
+/// The first step splits [0, count) so that both parts have at most 2^Log2Step elements, every
+/// other step halves a power of two, so the number of steps and their sizes are constants
+/// @return index of the first element not less than @value, in [0, count]
+template <int Log2Step>
+inline int64_t fixedStepLowerBound(const int *hayStack, int64_t count, int value)
+{
+    constexpr int64_t step = int64_t(1) << Log2Step;
+    // last index of an element less than value, -1 if there is none
+    int64_t last = hayStack[count - step] < value ? count - step : -1;
+
+    [&]<int... S>(std::integer_sequence<int, S...>) {
+        // written as a select of two indices so it compiles to a conditional move
+        ((last = hayStack[last + (step >> (S + 1))] < value ? last + (step >> (S + 1)) : last),
+         ...);
+    }(std::make_integer_sequence<int, Log2Step>{});
+
+    return last + 1;
+}
+
+template <int Log2Step>
+void unrolledKernel(
+    const AlignedIntArray &hayStack, const AlignedIntArray &needles, AlignedIndexArray &indices)
+{
+    const int64_t haystackCount = hayStack.count;
+    const int *haystackPtr = hayStack.aligned;
+
+    for (int64_t c = 0; c < needles.count; c++) {
+        const int value = needles[c];
+        const int64_t left = fixedStepLowerBound<Log2Step>(haystackPtr, haystackCount, value);
+        indices[c] = left < haystackCount && haystackPtr[left] == value ? left : NOT_FOUND;
+    }
+}
+
+template <int Log2Step>
+void avx256UnrolledKernel(
+    const AlignedIntArray &hayStack, const AlignedIntArray &needles, AlignedIndexArray &indices)
+{
+    constexpr int step = 1 << Log2Step;
+    const int64_t haystackCount = hayStack.count;
+    const int64_t needlesCount = needles.count;
+    const int *haystackPtr = hayStack.aligned;
+    int64_t *indicesPtr = indices.aligned;
+
+    const __m256i ones = _mm256_set1_epi32(1);
+    const __m256i neg1 = _mm256_set1_epi32(-1); // all true mask
+    const __m256i countV = _mm256_set1_epi32(int(haystackCount));
+    // the first step compares every lane with the same element
+    const __m256i firstTest = _mm256_set1_epi32(haystackPtr[haystackCount - step]);
+    const __m256i firstLast = _mm256_set1_epi32(int(haystackCount - step));
+
+    int64_t c = 0;
+    for (; c + 8 <= needlesCount; c += 8) {
+        const __m256i value =
+            _mm256_load_si256(reinterpret_cast<const __m256i *>(needles.get() + c));
+
+        // last index of an element less than value, -1 if there is none
+        __m256i last = _mm256_blendv_epi8(neg1, firstLast, _mm256_cmpgt_epi32(value, firstTest));
+
+        [&]<int... S>(std::integer_sequence<int, S...>) {
+            ((
+                 [&] {
+                     const __m256i half = _mm256_set1_epi32(step >> (S + 1));
+                     const __m256i probe = _mm256_add_epi32(last, half);
+                     const __m256i testValue =
+                         _mm256_i32gather_epi32(haystackPtr, probe, sizeof(int));
+                     const __m256i ltMask = _mm256_cmpgt_epi32(value, testValue);
+                     last = _mm256_add_epi32(last, _mm256_and_si256(ltMask, half));
+                 }()),
+             ...);
+        }(std::make_integer_sequence<int, Log2Step>{});
+
+        // the lower bound is one past the last smaller element and may be past the end
+        const __m256i left = _mm256_add_epi32(last, ones);
+        const __m256i inRange = _mm256_cmpgt_epi32(countV, left);
+        const __m256i haystackLeft = _mm256_mask_i32gather_epi32(
+            _mm256_setzero_si256(), haystackPtr, left, inRange, sizeof(int));
+        // if (hayStack[left] == value) {
+        const __m256i eqMask = _mm256_and_si256(_mm256_cmpeq_epi32(value, haystackLeft), inRange);
+        const __m256i storeResult = _mm256_blendv_epi8(neg1, left, eqMask);
+
+        storeIndices(indicesPtr + c, storeResult);
+    }
+
+    for (; c < needlesCount; c++) {
+        const int value = needles[c];
+        const int64_t left = fixedStepLowerBound<Log2Step>(haystackPtr, haystackCount, value);
+        indices[c] = left < haystackCount && haystackPtr[left] == value ? left : NOT_FOUND;
+    }
+}
+
+typedef void (*UnrolledKernel)(
+    const AlignedIntArray &hayStack, const AlignedIntArray &needles, AlignedIndexArray &indices);
+
+/// Kernel for every size class, indexed by sizeClass(haystack count)
+template <int... Log2Step>
+constexpr std::array<UnrolledKernel, sizeof...(Log2Step)> makeUnrolledTable(
+    std::integer_sequence<int, Log2Step...>)
+{
+    return {unrolledKernel<Log2Step>...};
+}
+
+template <int... Log2Step>
+constexpr std::array<UnrolledKernel, sizeof...(Log2Step)> makeAvx256UnrolledTable(
+    std::integer_sequence<int, Log2Step...>)
+{
+    return {avx256UnrolledKernel<Log2Step>...};
+}
+} // namespace
+
+/// Binary search with the loop fully unrolled for the size class of the haystack
+/// The kernel for each power of two size class is generated at compile time and picked from a
+/// table, so the hot loop has no step counter and no count updates, only a conditional move
+static void binarySearchUnrolled(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
+{
+    static constexpr auto kernels =
+        makeUnrolledTable(std::make_integer_sequence<int, MaxUnrolledLog2 + 1>{});
+
+    const int log2Step = sizeClass(hayStack.count);
+    if (log2Step > MaxUnrolledLog2) {
+        return binarySearch(hayStack, needles, indices);
+    }
+    kernels[log2Step](hayStack, needles, indices);
+}
+
+/// Same as binarySearchUnrolled with 8 needles per AVX2 register
+/// Small haystacks are searched with avx256LinearScan as in avx256
+static void avx256Unrolled(
+    const AlignedIntArray &hayStack,
+    const AlignedIntArray &needles,
+    AlignedIndexArray &indices,
+    ArenaAllocator &allocator)
+{
+    static constexpr auto kernels =
+        makeAvx256UnrolledTable(std::make_integer_sequence<int, MaxUnrolledLog2SIMD + 1>{});
+
+    if (hayStack.count <= LinearScanMaxCount) {
+        return avx256LinearScan(hayStack, needles, indices, allocator);
+    }
+    // lanes keep haystack indices in 32 bits
+    if (hayStack.count > INT_MAX) {
+        return binarySearchUnrolled(hayStack, needles, indices, allocator);
+    }
+    kernels[sizeClass(hayStack.count)](hayStack, needles, indices);
+}
@@ -14,8 +14,6 @@
 #include "utils.hpp"
 #include "solution-picker.hpp"
 
-const int HEAP_SIZE = (1 << 24) + 1;
-
 
 int main() {
 	printf("+ Correctness tests ... \n");
@@ -37,27 +35,32 @@ int main() {
 
 		printf("Checking %s... ", fname);
 
-		AlignedArrayPtr<int> indices(needles.getCount());
-		AlignedArrayPtr<uint8_t> heap(HEAP_SIZE);
-
-		StackAllocator allocator(heap, HEAP_SIZE);
+		AlignedIndexArray indices(needles.getCount());
+		ArenaAllocator &allocator = threadArena();
+		size_t arenaBytes = 0;
 		{
 			indices.memset(NOT_SEARCHED);
-			allocator.zeroAll();
+			allocator.reserve(ARENA_RESERVE_BYTES);
+			allocator.resetHighWater();
 			TEST_SEARCH(hayStack, needles, indices, allocator);
-			if (verify(hayStack, needles, indices) != -1) {
-				printf("Failed to verify base betterSearch!\n");
+			arenaBytes = allocator.highWaterBytes();
+			VerifyResult result = parallelVerify(hayStack, needles, indices);
+			if (result.firstMismatch != -1) {
+				printf("Failed to verify base betterSearch! First mismatch at needle %lld, %lld mismatches\n",
+					(long long)result.firstMismatch, (long long)result.mismatchCount);
                 failedTests = true;
 			}
 
 			indices.memset(NOT_SEARCHED);
 			binarySearch(hayStack, needles, indices);
-			if (verify(hayStack, needles, indices) != -1) {
-				printf("Failed to verify base binarySearch!\n");
+			result = parallelVerify(hayStack, needles, indices);
+			if (result.firstMismatch != -1) {
+				printf("Failed to verify base binarySearch! First mismatch at needle %lld, %lld mismatches\n",
+					(long long)result.firstMismatch, (long long)result.mismatchCount);
                 failedTests = true;
 			}
 		}
-		printf("OK\n");
+		printf("OK, arena high water %lld bytes\n", (long long)arenaBytes);
 		++testCaseCount;
 	}
 
@@ -81,10 +84,8 @@ int main() {
 		const int testRepeat = 200;
 		//printf("Running speed test for %s, %d repeats ", fname, testRepeat);
 
-		AlignedArrayPtr<int> indices(needles.getCount());
-		AlignedArrayPtr<uint8_t> heap(HEAP_SIZE);
-
-		StackAllocator allocator(heap, HEAP_SIZE);
+		AlignedIndexArray indices(needles.getCount());
+		ArenaAllocator &allocator = threadArena();
 		uint64_t t0;
 		uint64_t t1;
 		uint64_t bestBinary = -1, bestBetter = -1;
@@ -121,5 +122,153 @@ int main() {
 		const double totalBetter = (double(t1 - t0) * 1e-9) / testRepeat;
 		printf("Test %d compare fastest [%f] compare average [%f]\n", r + 1, double(bestBinary) / bestBetter, double(totalBinary) / totalBetter);
 	}
-	return 0;
+
+	printf("Indexed solutions, built once per file ... \n");
+
+	for (int r = 0; r < testCaseCount; r++) {
+		AlignedArrayPtr<int> hayStack;
+		AlignedArrayPtr<int> needles;
+		char fname[64] = { 0, };
+		snprintf(fname, sizeof(fname), "%d.bsearch", r);
+
+		if (!loadFromFile(hayStack, needles, fname)) {
+			printf("Failed to load %s for indexed solutions, continuing\n", fname);
+			continue;
+		}
+
+		const int testRepeat = 50;
+		AlignedIndexArray indices(needles.getCount());
+		ArenaAllocator &allocator = threadArena();
+
+		for (const IndexedSolutionInfo &solution : indexedSolutions) {
+			// the needles of the file stand in for the query log
+			const uint64_t buildStart = timer_nsec();
+			const BuiltIndex index(solution, hayStack, &needles);
+			const uint64_t buildTime = timer_nsec() - buildStart;
+
+			uint64_t bestSearch = -1;
+			for (int test = 0; test < testRepeat; ++test) {
+				indices.memset(NOT_SEARCHED);
+				const uint64_t start = timer_nsec();
+				index.search(needles, indices, allocator);
+				bestSearch = std::min(bestSearch, timer_nsec() - start);
+			}
+
+			const bool ok = parallelVerify(hayStack, needles, indices).firstMismatch == -1;
+			failedTests |= !ok;
+			printf("Test %d %s build %f ms, %lld bytes, search %f ms%s\n",
+				r + 1,
+				solution.name,
+				double(buildTime) * 1e-6,
+				(long long)index.memoryBytes(),
+				double(bestSearch) * 1e-6,
+				ok ? "" : " FAILED");
+		}
+	}
+
+	printf("Breakdown of instrumented solutions ... \n");
+
+	for (int r = 0; r < testCaseCount; r++) {
+		AlignedArrayPtr<int> hayStack;
+		AlignedArrayPtr<int> needles;
+		char fname[64] = { 0, };
+		snprintf(fname, sizeof(fname), "%d.bsearch", r);
+
+		if (!loadFromFile(hayStack, needles, fname)) {
+			printf("Failed to load %s for breakdown, continuing\n", fname);
+			continue;
+		}
+
+		AlignedIndexArray indices(needles.getCount());
+		ArenaAllocator &allocator = threadArena();
+
+		for (const SolutionInfo &solution : instrumentedSolutions) {
+			indices.memset(NOT_SEARCHED);
+			SearchStats::reset();
+			const uint64_t start = SearchStats::now();
+			solution.search(hayStack, needles, indices, allocator);
+			const uint64_t cycles = SearchStats::now() - start;
+
+			const bool failed = parallelVerify(hayStack, needles, indices).firstMismatch != -1;
+			failedTests |= failed;
+			printf("Test %d %s%s\n", r + 1, solution.name, failed ? " FAILED" : "");
+			SearchStats::print(needles.getCount(), cycles);
+		}
+
+		// the index is built before the counters are reset, only the search is broken down
+		for (const IndexedSolutionInfo &solution : instrumentedIndexedSolutions) {
+			const BuiltIndex index(solution, hayStack);
+			indices.memset(NOT_SEARCHED);
+			SearchStats::reset();
+			const uint64_t start = SearchStats::now();
+			index.search(needles, indices, allocator);
+			const uint64_t cycles = SearchStats::now() - start;
+
+			const bool failed = parallelVerify(hayStack, needles, indices).firstMismatch != -1;
+			failedTests |= failed;
+			printf("Test %d %s%s\n", r + 1, solution.name, failed ? " FAILED" : "");
+			SearchStats::print(needles.getCount(), cycles);
+		}
+	}
+
+	printf("Output modes ... \n");
+
+	for (int r = 0; r < testCaseCount; r++) {
+		AlignedArrayPtr<int> hayStack;
+		AlignedArrayPtr<int> needles;
+		char fname[64] = { 0, };
+		snprintf(fname, sizeof(fname), "%d.bsearch", r);
+
+		if (!loadFromFile(hayStack, needles, fname)) {
+			printf("Failed to load %s for output modes, continuing\n", fname);
+			continue;
+		}
+
+		const int testRepeat = 50;
+		AlignedIndexArray indices(needles.getCount());
+		AlignedArrayPtr<uint8_t> bits((needles.getCount() + 7) / 8);
+		ArenaAllocator &allocator = threadArena();
+
+		for (const OutputModeInfo &mode : outputModes) {
+			uint64_t bestIndex = -1, bestBitmap = -1, bestCount = -1;
+			int64_t hits = 0;
+
+			for (int test = 0; test < testRepeat; ++test) {
+				uint64_t start = timer_nsec();
+				mode.search(hayStack, needles, indices, allocator);
+				bestIndex = std::min(bestIndex, timer_nsec() - start);
+
+				start = timer_nsec();
+				mode.bitmap(hayStack, needles, bits.get(), allocator);
+				bestBitmap = std::min(bestBitmap, timer_nsec() - start);
+
+				start = timer_nsec();
+				hits = mode.count(hayStack, needles, allocator);
+				bestCount = std::min(bestCount, timer_nsec() - start);
+			}
+
+			// the bitmap and the count must agree with the indices
+			int64_t expectedHits = 0;
+			bool modesMatch = parallelVerify(hayStack, needles, indices).firstMismatch == -1;
+			for (int64_t c = 0; c < needles.getCount(); c++) {
+				const bool found = indices[c] != NOT_FOUND;
+				expectedHits += found;
+				modesMatch &= found == bool((bits[c >> 3] >> (c & 7)) & 1);
+			}
+			modesMatch &= hits == expectedHits;
+			if (!modesMatch) {
+				failedTests = true;
+			}
+
+			printf("Test %d %s index %f ms, bitmap %f ms, count %f ms, %lld hits%s\n",
+				r + 1,
+				mode.name,
+				double(bestIndex) * 1e-6,
+				double(bestBitmap) * 1e-6,
+				double(bestCount) * 1e-6,
+				(long long)hits,
+				modesMatch ? "" : " FAILED");
+		}
+	}
+	return failedTests ? -1 : 0;
 }
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "utils.hpp"
+#include "solutions/string-keys.hpp"
+
+const int TEST_REPEAT = 10;
+
+/// Mix of short words, that fit in the prefix key, and long keys sharing their first bytes with
+/// many others, like the object names of a secondary index
+/// Some short words end in NUL bytes, they have the prefix key of the word without them
+std::string randomKey(std::mt19937 &rng) {
+	std::uniform_int_distribution<int> letter('a', 'z');
+	if (rng() & 1) {
+		std::string word(std::uniform_int_distribution<int>(1, 12)(rng), ' ');
+		for (char &ch : word) {
+			ch = char(letter(rng));
+		}
+		if (rng() % 16 == 0) {
+			word.append(std::uniform_int_distribution<int>(1, 3)(rng), '\0');
+		}
+		return word;
+	}
+	char key[64];
+	snprintf(key, sizeof(key), "tenant-%03d/object-%d",
+		std::uniform_int_distribution<int>(0, 999)(rng),
+		std::uniform_int_distribution<int>(0, 1 << 20)(rng));
+	return key;
+}
+
+void packStrings(const std::vector<std::string> &strings, StringArray &array) {
+	int64_t totalBytes = 0;
+	for (const std::string &str : strings) {
+		totalBytes += str.size();
+	}
+	array.init(strings.size(), totalBytes);
+	array.offsets[0] = 0;
+	for (int64_t c = 0; c < int64_t(strings.size()); c++) {
+		memcpy(array.chars.get() + array.offsets[c], strings[c].data(), strings[c].size());
+		array.offsets[c + 1] = array.offsets[c] + strings[c].size();
+	}
+}
+
+/// std::lower_bound over the strings, the reference and the baseline
+void stringLowerBound(const StringHayStack &hayStack, const StringArray &needles, AlignedIndexArray &indices) {
+	const StringArray &keys = hayStack.keys;
+	for (int64_t c = 0; c < needles.getCount(); c++) {
+		const std::string_view needle = needles[c];
+		int64_t left = 0;
+		int64_t count = keys.getCount();
+		while (count > 0) {
+			const int64_t half = count / 2;
+			if (keys[left + half] < needle) {
+				left += half + 1;
+				count -= half + 1;
+			} else {
+				count = half;
+			}
+		}
+		indices[c] = left < keys.getCount() && keys[left] == needle ? left : NOT_FOUND;
+	}
+}
+
+/// Check @indices against std::lower_bound over the sorted strings
+int64_t verifyStrings(const std::vector<std::string> &hayStack, const StringArray &needles, const AlignedIndexArray &indices) {
+	for (int64_t c = 0; c < needles.getCount(); c++) {
+		const std::string_view needle = needles[c];
+		const auto pos = std::lower_bound(hayStack.begin(), hayStack.end(), needle);
+		const int64_t expected = pos != hayStack.end() && *pos == needle ? pos - hayStack.begin() : NOT_FOUND;
+		if (indices[c] != expected) {
+			return c;
+		}
+	}
+	return -1;
+}
+
+/// Compare the prefix key searches with a search over the full strings
+/// usage: string-test [haystack=1048576] [needles=1048576]
+int main(int argc, char *argv[]) {
+	const int64_t haystackCount = argc > 1 ? std::max(1ll, atoll(argv[1])) : 1 << 20;
+	const int64_t needlesCount = argc > 2 ? std::max(1ll, atoll(argv[2])) : 1 << 20;
+
+	std::mt19937 rng(42);
+	std::vector<std::string> keys(haystackCount);
+	for (std::string &key : keys) {
+		key = randomKey(rng);
+	}
+	std::sort(keys.begin(), keys.end());
+
+	// half of the needles are in the haystack
+	std::vector<std::string> needleKeys(needlesCount);
+	for (int64_t c = 0; c < needlesCount; c++) {
+		needleKeys[c] = (c & 1) ? keys[std::uniform_int_distribution<int64_t>(0, haystackCount - 1)(rng)] : randomKey(rng);
+	}
+
+	StringHayStack hayStack;
+	packStrings(keys, hayStack.keys);
+	hayStack.build();
+	StringArray needles;
+	packStrings(needleKeys, needles);
+	AlignedIndexArray indices(needlesCount);
+
+	printf("%lld keys, %lld needles\n", (long long)haystackCount, (long long)needlesCount);
+
+	const bool passed = timeVerifiedMethods(TEST_REPEAT, needlesCount, {
+		{"stringLowerBound", [&] { stringLowerBound(hayStack, needles, indices); }},
+		{"stringBinarySearch", [&] { stringBinarySearch(hayStack, needles, indices); }},
+		{"avx256StringSearch", [&] { avx256StringSearch(hayStack, needles, indices); }},
+	}, indices, [&] { return verifyStrings(keys, needles, indices); });
+	return passed ? 0 : -1;
+}
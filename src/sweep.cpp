@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <random>
+
+#include "utils.hpp"
+#include "parallel.hpp"
+#include "solution-picker.hpp"
+
+
+/// Minimum time spent timing one (solution, haystack, needles) point, repeats until reached
+const uint64_t MIN_POINT_NSEC = 100 * 1000 * 1000;
+const int MIN_REPEATS = 3;
+const int MAX_REPEATS = 1000;
+
+const int needleCounts[] = { 1 << 10, 1 << 16, 1 << 20 };
+
+/// Fill @hayStack with sorted uniform values in [0, 2 * count]
+void initSweepHayStack(AlignedIntArray &hayStack, std::mt19937 &rng) {
+	const int64_t count = hayStack.getCount();
+	std::uniform_int_distribution<int> dataDist(0, int(std::min<int64_t>(INT_MAX, count * 2)));
+
+	for (int64_t c = 0; c < hayStack.getCount(); c++) {
+		hayStack[c] = dataDist(rng);
+	}
+	parallelSort(hayStack.begin(), hayStack.end());
+}
+
+/// Fill @needles with half values picked from @hayStack and half uniform values in [0, 4 * count]
+void initSweepNeedles(const AlignedIntArray &hayStack, AlignedIntArray &needles, std::mt19937 &rng) {
+	const int64_t count = hayStack.getCount();
+	std::uniform_int_distribution<int> queryDist(0, int(std::min<int64_t>(INT_MAX, count * 4)));
+	std::uniform_int_distribution<int64_t> pickDist(0, count - 1);
+
+	for (int64_t c = 0; c < needles.getCount(); c++) {
+		needles[c] = (c & 1) ? queryDist(rng) : hayStack[pickDist(rng)];
+	}
+}
+
+/// Run @search until the time budget is used and return the average and best ns per needle
+template <typename Search>
+void timeSolution(
+	Search &&search,
+	const AlignedIntArray &needles,
+	double &averageNs,
+	double &bestNs) {
+	uint64_t best = -1;
+	int repeats = 0;
+	const uint64_t t0 = timer_nsec();
+	uint64_t t1 = t0;
+	while (repeats < MAX_REPEATS && (repeats < MIN_REPEATS || t1 - t0 < MIN_POINT_NSEC)) {
+		const uint64_t start = timer_nsec();
+		search();
+		t1 = timer_nsec();
+		best = std::min(best, t1 - start);
+		++repeats;
+	}
+
+	averageNs = double(t1 - t0) / repeats / needles.getCount();
+	bestNs = double(best) / needles.getCount();
+}
+
+/// Sweep all solutions over haystack sizes from 2^minLog2 to 2^maxLog2 and print CSV with ns/needle
+/// Usage: sweep [minLog2 = 10] [maxLog2 = 30] [stepsPerOctave = 1]
+int main(int argc, char *argv[]) {
+	const int minLog2 = argc > 1 ? atoi(argv[1]) : 10;
+	const int maxLog2 = argc > 2 ? atoi(argv[2]) : 30;
+	const int stepsPerOctave = argc > 3 ? std::max(1, atoi(argv[3])) : 1;
+
+	if (minLog2 < 1 || maxLog2 > 40 || minLog2 > maxLog2) {
+		printf("Haystack sizes must be in [2^1, 2^40], got [2^%d, 2^%d]\n", minLog2, maxLog2);
+		return -1;
+	}
+
+	ArenaAllocator &allocator = threadArena();
+	allocator.reserve(ARENA_RESERVE_BYTES);
+
+	std::mt19937 rng(42);
+	bool failedTests = false;
+
+	printf("solution,hayStackCount,needleCount,averageNsPerNeedle,bestNsPerNeedle\n");
+	for (int s = minLog2 * stepsPerOctave; s <= maxLog2 * stepsPerOctave; s++) {
+		const int64_t hayStackCount = int64_t(std::exp2(double(s) / stepsPerOctave));
+		AlignedIntArray hayStack(hayStackCount);
+		const uint64_t buildStart = timer_nsec();
+		initSweepHayStack(hayStack, rng);
+		// build time goes to stderr to keep the CSV clean
+		fprintf(stderr, "# hayStackCount %lld generated and sorted in %f ms with %d threads\n",
+			(long long)hayStackCount,
+			double(timer_nsec() - buildStart) * 1e-6,
+			hardwareThreads());
+
+		AlignedIntArray needleSets[std::size(needleCounts)];
+		for (size_t n = 0; n < std::size(needleCounts); n++) {
+			needleSets[n].init(needleCounts[n]);
+			initSweepNeedles(hayStack, needleSets[n], rng);
+		}
+
+		// check and time @search on every needle set
+		auto sweepPoint = [&](const char *name, auto &&search) {
+			for (const AlignedIntArray &needles : needleSets) {
+				AlignedIndexArray indices(needles.getCount());
+				indices.memset(NOT_SEARCHED);
+				search(needles, indices);
+				if (verify(hayStack, needles, indices) != -1) {
+					printf("%s,%lld,%lld,FAILED,FAILED\n", name, (long long)hayStackCount, (long long)needles.getCount());
+					failedTests = true;
+					continue;
+				}
+
+				double averageNs, bestNs;
+				timeSolution([&] { search(needles, indices); }, needles, averageNs, bestNs);
+				printf(
+					"%s,%lld,%lld,%f,%f\n",
+					name,
+					(long long)hayStackCount,
+					(long long)needles.getCount(),
+					averageNs,
+					bestNs);
+				fflush(stdout);
+			}
+		};
+
+		for (const SolutionInfo &solution : allSolutions) {
+			sweepPoint(solution.name, [&](const AlignedIntArray &needles, AlignedIndexArray &indices) {
+				solution.search(hayStack, needles, indices, allocator);
+			});
+		}
+
+		// indices are built once per haystack, only the searches are timed
+		for (const IndexedSolutionInfo &solution : indexedSolutions) {
+			const uint64_t indexStart = timer_nsec();
+			const BuiltIndex index(solution, hayStack);
+			fprintf(stderr, "# %s index of %lld values built in %f ms, %lld bytes\n",
+				solution.name,
+				(long long)hayStackCount,
+				double(timer_nsec() - indexStart) * 1e-6,
+				(long long)index.memoryBytes());
+			sweepPoint(solution.name, [&](const AlignedIntArray &needles, AlignedIndexArray &indices) {
+				index.search(needles, indices, allocator);
+			});
+		}
+	}
+
+	return failedTests ? -1 : 0;
+}
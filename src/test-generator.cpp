@@ -1,26 +1,31 @@
 #include <random>
+#include <cmath>
 #include <filesystem>
+#include <fstream>
+#include <atomic>
 #include <cstring>
+#include <vector>
 
 #include "utils.hpp"
+#include "parallel.hpp"
 
 
 enum DataType {
-	uniform, allFound, allSame, allDifferent, normal, minMax, mostOut
+	uniform, allFound, allSame, allDifferent, normal, minMax, mostOut, skewed
 };
 
 void initData(AlignedArrayPtr<int> &haystack, AlignedArrayPtr<int> &needles, DataType type) {
 	std::mt19937 rng(42);
 	switch (type) {
 	case uniform: {
-		std::uniform_int<int> dataDist(0, haystack.getCount() << 1);
-		std::uniform_int<int> queryDist(0, haystack.getCount() << 2);
+		std::uniform_int_distribution<int> dataDist(0, haystack.getCount() << 1);
+		std::uniform_int_distribution<int> queryDist(0, haystack.getCount() << 2);
 
-		for (int c = 0; c < haystack.getCount(); c++) {
+		for (int64_t c = 0; c < haystack.getCount(); c++) {
 			haystack[c] = dataDist(rng);
 		}
 
-		for (int r = 0; r < needles.getCount(); r++) {
+		for (int64_t r = 0; r < needles.getCount(); r++) {
 			needles[r] = queryDist(rng);
 		}
 		break;
@@ -34,14 +39,14 @@ void initData(AlignedArrayPtr<int> &haystack, AlignedArrayPtr<int> &needles, Dat
 		memset(needles, 24, needles.getCount() * sizeof(needles[0]));
 		break;
 	case allFound: {
-		std::uniform_int<int> dataDist(0, haystack.getCount() << 1);
-		std::uniform_int<int> queryDist(0, haystack.getCount());
+		std::uniform_int_distribution<int> dataDist(0, haystack.getCount() << 1);
+		std::uniform_int_distribution<int> queryDist(0, haystack.getCount());
 
-		for (int c = 0; c < haystack.getCount(); c++) {
+		for (int64_t c = 0; c < haystack.getCount(); c++) {
 			haystack[c] = dataDist(rng);
 		}
 
-		for (int c = 0; c < needles.getCount(); c++) {
+		for (int64_t c = 0; c < needles.getCount(); c++) {
 			needles[c] = haystack[queryDist(rng)];
 		}
 		break;
@@ -50,39 +55,57 @@ void initData(AlignedArrayPtr<int> &haystack, AlignedArrayPtr<int> &needles, Dat
 		std::normal_distribution<double> dataDist(0, 1024);
 		std::normal_distribution<double> queryDist(1024 * 3, 1024);
 
-		for (int c = 0; c < haystack.getCount(); c++) {
+		for (int64_t c = 0; c < haystack.getCount(); c++) {
 			haystack[c] = dataDist(rng);
 		}
 
-		for (int r = 0; r < needles.getCount(); r++) {
+		for (int64_t r = 0; r < needles.getCount(); r++) {
 			needles[r] = queryDist(rng);
 		}
 		break;
 	}
 	case minMax: {
-		std::uniform_int<int> dataDist(0, haystack.getCount() << 1);
-		for (int c = 0; c < haystack.getCount(); c++) {
+		std::uniform_int_distribution<int> dataDist(0, haystack.getCount() << 1);
+		for (int64_t c = 0; c < haystack.getCount(); c++) {
 			haystack[c] = dataDist(rng);
 		}
 
-		for (int c = 0; c < needles.getCount(); c++) {
-			const int valueIndex = (c & 1) * (haystack.getCount() - 1);
+		for (int64_t c = 0; c < needles.getCount(); c++) {
+			const int64_t valueIndex = (c & 1) * (haystack.getCount() - 1);
 			needles[c] = haystack[valueIndex];
 		}
 	}
 	case mostOut: {
-		std::uniform_int<int> dataDist(INT_MIN, INT_MAX);
-		std::uniform_int<int> queryDist(0, 1 >> 16);
+		std::uniform_int_distribution<int> dataDist(INT_MIN, INT_MAX);
+		std::uniform_int_distribution<int> queryDist(0, 1 >> 16);
 
-		for (int c = 0; c < haystack.getCount(); c++) {
+		for (int64_t c = 0; c < haystack.getCount(); c++) {
 			haystack[c] = dataDist(rng);
 		}
 
-		for (int r = 0; r < needles.getCount(); r++) {
+		for (int64_t r = 0; r < needles.getCount(); r++) {
 			needles[r] = queryDist(rng);
 		}
 		break;
 	}
+	case skewed: {
+		// Zipf like query log: the rank is u^-5 for uniform u, about 3/4 of the needles are
+		// among the 1024 most frequent keys, about half of the keys are not in the haystack
+		std::uniform_int_distribution<int> dataDist(0, haystack.getCount() << 1);
+		std::uniform_real_distribution<double> rankDist(0, 1);
+
+		for (int64_t c = 0; c < haystack.getCount(); c++) {
+			haystack[c] = dataDist(rng);
+		}
+
+		const uint64_t valueRange = uint64_t(haystack.getCount() << 1) + 1;
+		for (int64_t r = 0; r < needles.getCount(); r++) {
+			const double rank = std::min(std::pow(1 - rankDist(rng), -5.0), 1e18);
+			// hot keys are spread over the value range, not packed at its start
+			needles[r] = int(uint64_t(rank) * 0x9E3779B97F4A7C15ull % valueRange);
+		}
+		break;
+	}
 	default:
 		bassert(false);
 		return;
@@ -91,8 +114,8 @@ void initData(AlignedArrayPtr<int> &haystack, AlignedArrayPtr<int> &needles, Dat
 
 
 struct {
-	int hCount;
-	int qCount;
+	int64_t hCount;
+	int64_t qCount;
 	DataType type;
 } testInfos[] = {
 	/*1*/ {1 << 26, 1 << 16, uniform},
@@ -104,21 +127,27 @@ struct {
 	/*7*/ {1 << 20, 1 << 16, allDifferent},
 	/*8*/ {1 << 20, 1 << 16, allSame},
 	/*9*/ {1 << 20, 1 << 10, allSame},
+	/*10*/ {1 << 26, 1 << 18, skewed},
 };
 
 bool generateInputFiles(bool forceRecreate = false) {
 	const int variants = std::size(testInfos);
 
-	for (int c = 0; c < variants; c++) {
+	for (int64_t c = 0; c < variants; c++) {
 		char fname[64] = { 0, };
-		snprintf(fname, sizeof(fname), "%d.bsearch", c);
+		snprintf(fname, sizeof(fname), "%lld.bsearch", (long long)c);
 		const bool create = forceRecreate || !std::filesystem::exists(fname);
 
 		AlignedArrayPtr<int> hayStack(testInfos[c].hCount);
 		AlignedArrayPtr<int> needles(testInfos[c].qCount);
 		if (create) {
 			initData(hayStack, needles, testInfos[c].type);
-			std::sort(hayStack.get(), hayStack + hayStack.getCount());
+			const uint64_t sortStart = timer_nsec();
+			parallelSort(hayStack.get(), hayStack + hayStack.getCount());
+			printf("Sorted %lld values in %f ms with %d threads ... ",
+				(long long)hayStack.getCount(),
+				double(timer_nsec() - sortStart) * 1e-6,
+				hardwareThreads());
 
 			printf("Saving to file %s ... ", fname);
 			storeToFile(hayStack, needles, fname);
@@ -138,7 +167,123 @@ bool generateInputFiles(bool forceRecreate = false) {
 	return true;
 }
 
-int main() {
-	generateInputFiles(true);
+/// Values generated, sorted and written by one task of a streamed file, 16MB
+const int64_t STREAM_CHUNK = 1 << 22;
+
+/// splitmix64 of the seed and the chunk, so a chunk has the same values on any thread count
+uint64_t chunkSeed(uint64_t seed, uint64_t chunk) {
+	uint64_t z = seed + (chunk + 1) * 0x9E3779B97F4A7C15ull;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+/// Generate a uniform .bsearch file of any size without holding it in memory
+/// The haystack is stratified: chunk k gets the values of the k-th slice of the value range in
+/// proportion to its slice of the indices, so sorting each chunk on its own sorts the whole
+/// haystack and there is no global sort
+/// Every chunk has its own seed and is written at its offset by the thread that made it, the
+/// file is the same for any thread count
+/// @param threadCount - 0 for hardwareThreads()
+bool generateStreamed(const char *name, int64_t hCount, int64_t qCount, uint64_t seed, int threadCount) {
+	{
+		std::ofstream header(name, std::ios::binary | std::ios::trunc);
+		const int64_t sizes[2] = { hCount, qCount };
+		header.write(magic, magicSize);
+		header.write(reinterpret_cast<const char *>(sizes), sizeof(sizes));
+		if (!header) {
+			printf("Failed to create %s\n", name);
+			return false;
+		}
+	}
+	const int64_t headerBytes = magicSize + 2 * sizeof(int64_t);
+	std::error_code error;
+	std::filesystem::resize_file(name, headerBytes + (hCount + qCount) * sizeof(int), error);
+	if (error) {
+		printf("Failed to resize %s: %s\n", name, error.message().c_str());
+		return false;
+	}
+
+	// same ranges as the uniform DataType, as far as they fit in an int
+	const int64_t dataRange = std::min<int64_t>(hCount << 1, INT_MAX) + 1;
+	const int64_t queryMax = std::min<int64_t>(hCount << 2, INT_MAX);
+	const int64_t hChunks = (hCount + STREAM_CHUNK - 1) / STREAM_CHUNK;
+	const int64_t qChunks = (qCount + STREAM_CHUNK - 1) / STREAM_CHUNK;
+
+	const int threads = int(std::min<int64_t>(threadCount > 0 ? threadCount : hardwareThreads(), hChunks + qChunks));
+	std::atomic<bool> allOk = true;
+	// chunk k goes to thread k % threads, so the haystack chunks that cost more are spread
+	parallelFor(threads, [&](int64_t thread, int64_t) {
+		std::fstream file(name, std::ios::binary | std::ios::in | std::ios::out);
+		std::vector<int> values;
+		std::vector<int> counts;
+		for (int64_t k = thread; k < hChunks + qChunks && file; k += threads) {
+			std::mt19937_64 rng(chunkSeed(seed, k));
+			const bool isHay = k < hChunks;
+			const int64_t chunk = isHay ? k : k - hChunks;
+			const int64_t begin = chunk * STREAM_CHUNK;
+			const int64_t end = std::min((chunk + 1) * STREAM_CHUNK, isHay ? hCount : qCount);
+			values.resize(end - begin);
+
+			if (isHay) {
+				// [begin * range / count, end * range / count) does not overlap the next chunk
+				const int64_t low = int64_t(double(begin) * double(dataRange) / double(hCount));
+				const int64_t high = int64_t(double(end) * double(dataRange) / double(hCount)) - 1;
+				std::uniform_int_distribution<int64_t> dataDist(low, std::max(low, high));
+				// the slice has at most about 2 values per index, a counting sort is linear
+				counts.assign(std::max(low, high) - low + 1, 0);
+				for (int64_t c = begin; c < end; c++) {
+					counts[dataDist(rng) - low]++;
+				}
+				int *out = values.data();
+				for (int64_t v = 0; v < int64_t(counts.size()); v++) {
+					out = std::fill_n(out, counts[v], int(low + v));
+				}
+			} else {
+				std::uniform_int_distribution<int64_t> queryDist(0, queryMax);
+				for (int &value : values) {
+					value = int(queryDist(rng));
+				}
+			}
+
+			file.seekp(headerBytes + ((isHay ? 0 : hCount) + begin) * int64_t(sizeof(int)));
+			file.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(int));
+		}
+		if (!file) {
+			allOk = false;
+		}
+	}, threads);
+	return allOk;
+}
+
+/// usage: test-generator - regenerate the test files 0.bsearch ... in the current directory
+/// usage: test-generator <file.bsearch> <haystackCount> <needlesCount> [seed=42] [threads=0]
+///        - stream a uniform file of any size, see generateStreamed, the other DataTypes need the
+///        whole haystack in memory for their sort and are only made as the test files
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		generateInputFiles(true);
+		return 0;
+	}
+	if (argc < 4) {
+		printf("usage: %s [<file.bsearch> <haystackCount> <needlesCount> [seed=42] [threads=0]]\n", argv[0]);
+		printf("  with a file name, streams a file of uniform data, the only type that can be streamed\n");
+		return -1;
+	}
+
+	const int64_t hCount = std::max(1ll, atoll(argv[2]));
+	const int64_t qCount = std::max(1ll, atoll(argv[3]));
+	const uint64_t seed = argc > 4 ? strtoull(argv[4], nullptr, 10) : 42;
+	const int threads = argc > 5 ? atoi(argv[5]) : 0;
+
+	const uint64_t start = timer_nsec();
+	if (!generateStreamed(argv[1], hCount, qCount, seed, threads)) {
+		printf("Failed to write %s\n", argv[1]);
+		return -1;
+	}
+	const double seconds = double(timer_nsec() - start) * 1e-9;
+	const double gigabytes = double(hCount + qCount) * sizeof(int) / double(1 << 30);
+	printf("Wrote %s: %lld values, %lld needles, %f GB in %f s, %f GB/s\n",
+		argv[1], (long long)hCount, (long long)qCount, gigabytes, seconds, gigabytes / seconds);
 	return 0;
 }